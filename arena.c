@@ -0,0 +1,62 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct _ArenaBlock {
+    struct _ArenaBlock *next;
+    size_t used;
+    size_t capacity;
+    alignas(max_align_t) unsigned char data[];
+};
+
+static size_t align_up(size_t size) {
+    return (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size);
+
+    ArenaBlock *block = arena->head;
+    if (!block || block->capacity - block->used < size) {
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + capacity);
+        block->used = 0;
+        block->capacity = capacity;
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->allocated += size;
+    return ptr;
+}
+
+/* Releases everything but the newest block, which is kept for reuse. */
+void arena_reset(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    if (!block) { return; }
+
+    ArenaBlock *rest = block->next;
+    while (rest) {
+        ArenaBlock *next = rest->next;
+        free(rest);
+        rest = next;
+    }
+
+    block->next = nullptr;
+    block->used = 0;
+    arena->allocated = 0;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    *arena = (Arena){0};
+}
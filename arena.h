@@ -0,0 +1,19 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Region allocator: allocations are bumped out of large blocks and are only ever released all at
+ * once, by resetting or freeing the whole arena. A zero-initialized Arena is empty and ready. */
+typedef struct _ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    size_t allocated;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+#endif // !ARENA_H
@@ -1,22 +1,37 @@
 #include "ast.h"
+#include "intern.h"
 
-#include <stdlib.h>
-#include <string.h>
+#include <threads.h>
+
+Arena ast_arena;
+Arena proof_arena;
+
+static mtx_t alloc_lock;
+static once_flag alloc_lock_once = ONCE_FLAG_INIT;
+
+static void init_alloc_lock(void) { mtx_init(&alloc_lock, mtx_plain); }
+
+void *ast_alloc(Arena *arena, size_t size) {
+    call_once(&alloc_lock_once, init_alloc_lock);
+    mtx_lock(&alloc_lock);
+    void *node = arena_alloc(arena, size);
+    mtx_unlock(&alloc_lock);
+    return node;
+}
+
+void free_ast(void) {
+    free_intern_tables();
+    arena_free(&ast_arena);
+    arena_free(&proof_arena);
+}
 
 Program *new_program(TopLevel toplevel, Program *rest) {
-    Program *program = malloc(sizeof(Program));
+    Program *program = ast_alloc(&ast_arena, sizeof(Program));
     program->toplevel = toplevel;
     program->rest = rest;
     return program;
 }
 
-void free_program(Program *program) {
-    if (!program) { return; }
-    free_toplevel(&program->toplevel);
-    free_program(program->rest);
-    free(program);
-}
-
 TopLevel new_toplevel_define(Define define) {
     return (TopLevel){
         .tag = TOPLEVEL_DEFINE,
@@ -38,180 +53,131 @@ TopLevel new_toplevel_example(Example example) {
     };
 }
 
-void free_toplevel(TopLevel *toplevel) {
-    if (!toplevel) { return; }
-
-    switch (toplevel->tag) {
-    case TOPLEVEL_DEFINE:
-        free_define(&toplevel->define);
-        break;
-    case TOPLEVEL_THEOREM:
-        free_theorem(&toplevel->theorem);
-        break;
-    case TOPLEVEL_EXAMPLE:
-        free_example(&toplevel->example);
-        break;
-    }
+TopLevel new_toplevel_import(Import import) {
+    return (TopLevel){
+        .tag = TOPLEVEL_IMPORT,
+        .import = import,
+    };
 }
 
-Define new_define(Ident name, IdentList *params, Expr *lhs, Expr *rhs) {
+Define new_define(Ident name, IdentList *params, Expr *lhs, Marks lhs_marks, Expr *rhs,
+                  Marks rhs_marks) {
     return (Define){
         .name = name,
         .params = params,
         .lhs = lhs,
         .rhs = rhs,
+        .lhs_marks = lhs_marks,
+        .rhs_marks = rhs_marks,
     };
 }
 
-void free_define(Define *define) {
-    if (!define) { return; }
-    free(define->name);
-    free_ident_list(define->params);
-    free_expr(define->lhs);
-    free_expr(define->rhs);
-}
-
-Theorem new_theorem(Ident name, IdentList *params, Expr *lhs, Expr *rhs, Proof proof) {
+Theorem new_theorem(Ident name, IdentList *params, Expr *lhs, Marks lhs_marks, Expr *rhs,
+                    Marks rhs_marks, Proof proof) {
     return (Theorem){
         .name = name,
         .params = params,
         .lhs = lhs,
         .rhs = rhs,
+        .lhs_marks = lhs_marks,
+        .rhs_marks = rhs_marks,
         .proof = proof,
     };
 }
 
-void free_theorem(Theorem *theorem) {
-    if (!theorem) { return; }
-    free(theorem->name);
-    free_ident_list(theorem->params);
-    free_expr(theorem->lhs);
-    free_expr(theorem->rhs);
-    free_proof(&theorem->proof);
-}
-
-Example new_example(Expr *lhs, Expr *rhs, Proof proof) {
+Example new_example(Expr *lhs, Marks lhs_marks, Expr *rhs, Marks rhs_marks, Proof proof) {
     return (Example){
         .lhs = lhs,
         .rhs = rhs,
+        .lhs_marks = lhs_marks,
+        .rhs_marks = rhs_marks,
         .proof = proof,
     };
 }
 
-void free_example(Example *example) {
-    if (!example) { return; }
-    free_expr(example->lhs);
-    free_expr(example->rhs);
-    free_proof(&example->proof);
+Import new_import(char *path) {
+    return (Import){
+        .path = path,
+    };
 }
 
 IdentList *new_ident_list(Ident ident, IdentList *tail) {
-    IdentList *idents = malloc(sizeof(IdentList));
+    IdentList *idents = ast_alloc(&ast_arena, sizeof(IdentList));
     idents->head = ident;
     idents->tail = tail;
     return idents;
 }
 
-void free_ident_list(IdentList *ident_list) {
-    if (!ident_list) { return; }
-    free(ident_list->head);
-    free_ident_list(ident_list->tail);
-    free(ident_list);
-}
-
 bool ident_list_contains(Ident ident, IdentList *list) {
-    if (!list) { return false; }
-    if (!strcmp(ident, list->head)) { return true; }
-    return ident_list_contains(ident, list->tail);
+    for (; list; list = list->tail) {
+        if (ident == list->head) { return true; }
+    }
+    return false;
 }
 
 size_t ident_list_count(IdentList *params) {
-    if (!params) { return 0; }
-    return 1 + ident_list_count(params->tail);
+    size_t count = 0;
+    for (; params; params = params->tail) { count++; }
+    return count;
 }
 
-Expr *new_expr_zero(bool marked) {
-    Expr *expr = malloc(sizeof(Expr));
-    expr->tag = EXPR_ZERO;
-    expr->marked = marked;
-    return expr;
-}
+Expr *new_expr_zero(void) { return intern_expr(&(Expr){.tag = EXPR_ZERO}); }
 
-Expr *new_expr_num(int num, bool marked) {
-    if (num < 0) { return nullptr; }
-    if (num == 0) { return new_expr_zero(marked); }
+Expr *new_expr_num(const Nat *num) {
+    if (nat_is_zero(num)) { return new_expr_zero(); }
 
-    Expr *one_lower = new_expr_num(num - 1, false);
-    return new_expr_succ(one_lower, marked);
+    return intern_expr(&(Expr){
+        .tag = EXPR_NUM,
+        .num = num,
+    });
 }
 
-Expr *new_expr_var(Ident var, bool marked) {
-    Expr *expr = malloc(sizeof(Expr));
-    expr->tag = EXPR_VAR;
-    expr->var = var;
-    expr->marked = marked;
-    return expr;
+Expr *new_expr_var(Ident var) {
+    return intern_expr(&(Expr){
+        .tag = EXPR_VAR,
+        .var = var,
+    });
 }
 
-Expr *new_expr_sexp(ExprList *sexp, bool marked) {
-    Expr *expr = malloc(sizeof(Expr));
-    expr->tag = EXPR_SEXP;
-    expr->sexp = sexp;
-    expr->marked = marked;
-    return expr;
-}
+Expr *new_expr_sexp(Expr **elements, size_t count) { return intern_sexp(elements, count); }
 
-Expr *new_expr_succ(Expr *inner, bool marked) {
-    Ident succ_ident = strdup("succ");
-    Expr *succ_expr = new_expr_var(succ_ident, false);
-    ExprList *sexp = new_expr_list(succ_expr, new_expr_list(inner, nullptr));
-    return new_expr_sexp(sexp, marked);
+Expr *new_expr_succ(Expr *inner) {
+    Expr *elements[] = {new_expr_var(ident_succ()), inner};
+    return new_expr_sexp(elements, 2);
 }
 
-void free_expr(Expr *expr) {
-    if (!expr) { return; }
+/* Variables are summarized in a 64-bit set by the low bits of their hash, so an expression without
+ * the bit of a variable certainly doesn't contain it. */
+uint64_t var_bit(Ident var) { return (uint64_t)1 << (ident_hash(var) & 63); }
 
+bool expr_may_contain(Expr *expr, Ident var) { return expr->vars & var_bit(var); }
+
+Expr *expr_as_sexp(Expr *expr) {
     switch (expr->tag) {
-    case EXPR_ZERO:
-        break;
-    case EXPR_VAR:
-        free(expr->var);
-        break;
     case EXPR_SEXP:
-        free_expr_list(expr->sexp);
-        break;
+        return expr;
+    case EXPR_NUM:
+        return numeral_view(expr);
+    default:
+        return nullptr;
     }
-
-    free(expr);
-}
-
-ExprList *new_expr_list(Expr *expr, ExprList *tail) {
-    ExprList *exprs = malloc(sizeof(ExprList));
-    exprs->head = expr;
-    exprs->tail = tail;
-    return exprs;
 }
 
-void free_expr_list(ExprList *expr_list) {
-    if (!expr_list) { return; }
-    free_expr(expr_list->head);
-    free_expr_list(expr_list->tail);
-    free(expr_list);
+Expr *expr_at_path(Expr *expr, MarkPath *path) {
+    for (size_t i = 0; i < path->length; ++i) {
+        expr = expr_element(expr_as_sexp(expr), path->indices[i]);
+    }
+    return expr;
 }
 
-Direct new_direct(Expr *start, Transform *transform) {
+Direct new_direct(Expr *start, Marks start_marks, Transform *transform) {
     return (Direct){
         .start = start,
+        .start_marks = start_marks,
         .transform = transform,
     };
 }
 
-void free_direct(Direct *direct) {
-    if (!direct) { return; }
-    free_expr(direct->start);
-    free_transform(direct->transform);
-}
-
 Induction new_induction(Ident var, Direct base, Direct step) {
     return (Induction){
         .var = var,
@@ -220,13 +186,6 @@ Induction new_induction(Ident var, Direct base, Direct step) {
     };
 }
 
-void free_induction(Induction *induction) {
-    if (!induction) { return; }
-    free(induction->var);
-    free_direct(&induction->base);
-    free_direct(&induction->step);
-}
-
 Proof new_proof_direct(Direct direct) {
     return (Proof){
         .tag = PROOF_DIRECT,
@@ -241,63 +200,42 @@ Proof new_proof_induction(Induction induction) {
     };
 }
 
-void free_proof(Proof *proof) {
-    if (!proof) { return; }
-
-    switch (proof->tag) {
-    case PROOF_DIRECT:
-        free_direct(&proof->direct);
-        break;
-    case PROOF_INDUCTION:
-        free_induction(&proof->induction);
-        break;
-    }
-}
-
-Transform *new_transform_named(Ident name, bool reversed, Expr *target, Transform *next) {
-    Transform *transform = malloc(sizeof(Transform));
+Transform *new_transform_named(Ident name, bool reversed, Expr *target, Marks target_marks,
+                               Transform *next) {
+    Transform *transform = ast_alloc(&proof_arena, sizeof(Transform));
     transform->tag = TRANSFORM_NAMED;
     transform->name = name;
     transform->reversed = reversed;
     transform->target = target;
+    transform->target_marks = target_marks;
     transform->next = next;
     return transform;
 }
 
-Transform *new_transform_induction(Expr *target, Transform *next) {
-    Transform *transform = malloc(sizeof(Transform));
+Transform *new_transform_induction(Expr *target, Marks target_marks, Transform *next) {
+    Transform *transform = ast_alloc(&proof_arena, sizeof(Transform));
     transform->tag = TRANSFORM_INDUCTION;
     transform->target = target;
+    transform->target_marks = target_marks;
     transform->next = next;
     return transform;
 }
 
-Transform *new_transform_todo(Expr *target, Transform *next) {
-    Transform *transform = malloc(sizeof(Transform));
+Transform *new_transform_todo(Expr *target, Marks target_marks, Transform *next) {
+    Transform *transform = ast_alloc(&proof_arena, sizeof(Transform));
     transform->tag = TRANSFORM_TODO;
     transform->target = target;
+    transform->target_marks = target_marks;
     transform->next = next;
     return transform;
 }
 
-void free_transform(Transform *transform) {
-    if (!transform) { return; }
-
-    switch (transform->tag) {
-    case TRANSFORM_NAMED:
-        free(transform->name);
-        free_expr(transform->target);
-        free_transform(transform->next);
-        break;
-    case TRANSFORM_INDUCTION:
-        free_expr(transform->target);
-        free_transform(transform->next);
-        break;
-    case TRANSFORM_TODO:
-        free_expr(transform->target);
-        free_transform(transform->next);
-        break;
-    }
-
-    free(transform);
+Transform *new_transform_simp(Expr *target, Marks target_marks, Transform *next) {
+    Transform *transform = ast_alloc(&proof_arena, sizeof(Transform));
+    transform->tag = TRANSFORM_SIMP;
+    transform->target = target;
+    transform->target_marks = target_marks;
+    transform->next = next;
+    return transform;
 }
+
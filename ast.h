@@ -1,48 +1,88 @@
 #ifndef AST_H
 #define AST_H
 
+#include "arena.h"
+#include "nat.h"
+#include "stack.h"
+#include "symbol.h"
+
 #include <stddef.h>
-typedef char *Ident;
+#include <stdint.h>
 
 typedef struct _IdentList {
     Ident head;
     struct _IdentList *tail;
 } IdentList;
 
-typedef struct _ExprList ExprList;
-
-typedef struct {
+/* Expressions are hash-consed (see intern.h): structurally identical expressions are the same
+ * node, so two expressions are equal iff their pointers are. Nodes are immutable and owned by the
+ * intern tables.
+ * Nodes live in a single pool and refer to each other by 32-bit handles: a sexp is one node whose
+ * elements follow it inline, so walking a term touches one contiguous node per sexp.
+ * A numeral n > 0 is a single EXPR_NUM node standing for n nested `succ`s around 0. It is the only
+ * representation of such a chain: interning (succ 0) or (succ n) yields the numeral 1 or n + 1.
+ * Marks aren't part of expressions, they're kept beside the expression they were written in. */
+typedef struct _Expr {
     enum {
         EXPR_ZERO,
+        EXPR_NUM,
         EXPR_VAR,
         EXPR_SEXP,
     } tag;
+    uint32_t arity; /* the number of elements of a sexp */
+    uint64_t hash; /* structural, computed once from the elements' hashes when interning */
+    uint64_t vars; /* the var_bit of every variable in the expression */
     union {
+        const Nat *num;
         Ident var;
-        ExprList *sexp;
     };
-    bool marked;
+    uint32_t elements[]; /* the handles of a sexp's elements */
 } Expr;
 
-struct _ExprList {
-    Expr *head;
-    struct _ExprList *tail;
-};
+/* The pool of all interned nodes. A handle is the offset of a node in it, in units of 8 bytes. */
+extern unsigned char *expr_pool;
+
+static inline Expr *expr_at(uint32_t handle) { return (Expr *)(expr_pool + ((size_t)handle << 3)); }
+
+static inline uint32_t expr_handle(Expr *expr) {
+    return (uint32_t)(((unsigned char *)expr - expr_pool) >> 3);
+}
+
+static inline Expr *expr_element(Expr *sexp, size_t index) {
+    return expr_at(sexp->elements[index]);
+}
+
+/* A mark: the index of the element to descend into at each level, from the root of an expression
+ * down to the marked subexpression. A numeral n counts as (succ n-1). */
+typedef struct {
+    size_t length;
+    size_t *indices;
+} MarkPath;
+
+/* The marks written in an expression, in reading order. The parser records them once, so a step
+ * walks the path of its mark instead of searching the expression for it. */
+typedef struct {
+    size_t count;
+    MarkPath *paths;
+} Marks;
 
 typedef struct _Transform {
     enum {
         TRANSFORM_NAMED,
         TRANSFORM_INDUCTION,
         TRANSFORM_TODO,
+        TRANSFORM_SIMP,
     } tag;
     Ident name;
     bool reversed;
     Expr *target;
+    Marks target_marks;
     struct _Transform *next;
 } Transform;
 
 typedef struct {
     Expr *start;
+    Marks start_marks;
     Transform *transform;
 } Direct;
 
@@ -63,11 +103,14 @@ typedef struct {
     };
 } Proof;
 
+/* Marks in a statement are warned about and dropped when it's registered. */
 typedef struct {
     Ident name;
     IdentList *params;
     Expr *lhs;
     Expr *rhs;
+    Marks lhs_marks;
+    Marks rhs_marks;
 } Define;
 
 typedef struct {
@@ -75,25 +118,36 @@ typedef struct {
     IdentList *params;
     Expr *lhs;
     Expr *rhs;
+    Marks lhs_marks;
+    Marks rhs_marks;
     Proof proof;
 } Theorem;
 
 typedef struct {
     Expr *lhs;
     Expr *rhs;
+    Marks lhs_marks;
+    Marks rhs_marks;
     Proof proof;
 } Example;
 
+typedef struct {
+    char *path; /* as written, relative to the importing file */
+    size_t module; /* the imported module, resolved when loading it */
+} Import;
+
 typedef struct {
     enum {
         TOPLEVEL_DEFINE,
         TOPLEVEL_THEOREM,
         TOPLEVEL_EXAMPLE,
+        TOPLEVEL_IMPORT,
     } tag;
     union {
         Define define;
         Theorem theorem;
         Example example;
+        Import import;
     };
 } TopLevel;
 
@@ -102,40 +156,54 @@ typedef struct _Program {
     struct _Program *rest;
 } Program;
 
+/* Called by the parser for every toplevel as soon as it's parsed. Returning false stops parsing. */
+typedef bool (*ToplevelHandler)(TopLevel *toplevel, void *ctx);
+
+/* Every AST node is allocated from this arena, so all programs are released at once by
+ * `free_ast`, along with the interned expressions. */
+extern Arena ast_arena;
+/* The steps of proofs are the only nodes nothing refers to once the proof is verified. They have
+ * an arena of their own, which a streaming verifier resets after every toplevel. */
+extern Arena proof_arena;
+
+/* Allocates from one of the arenas above. Files may be parsed on several threads at once, so this
+ * takes a lock. */
+void *ast_alloc(Arena *arena, size_t size);
+void free_ast(void);
 Program *new_program(TopLevel toplevel, Program *rest);
-void free_program(Program *program);
 TopLevel new_toplevel_define(Define define);
 TopLevel new_toplevel_theorem(Theorem theorem);
 TopLevel new_toplevel_example(Example example);
-void free_toplevel(TopLevel *toplevel);
-Define new_define(Ident name, IdentList *params, Expr *lhs, Expr *rhs);
-void free_define(Define *define);
-Theorem new_theorem(Ident name, IdentList *params, Expr *lhs, Expr *rhs, Proof proof);
-void free_theorem(Theorem *theorem);
-Example new_example(Expr *lhs, Expr *rhs, Proof proof);
-void free_example(Example *example);
+TopLevel new_toplevel_import(Import import);
+Define new_define(Ident name, IdentList *params, Expr *lhs, Marks lhs_marks, Expr *rhs,
+                  Marks rhs_marks);
+Theorem new_theorem(Ident name, IdentList *params, Expr *lhs, Marks lhs_marks, Expr *rhs,
+                    Marks rhs_marks, Proof proof);
+Example new_example(Expr *lhs, Marks lhs_marks, Expr *rhs, Marks rhs_marks, Proof proof);
+Import new_import(char *path);
 IdentList *new_ident_list(Ident ident, IdentList *tail);
-void free_ident_list(IdentList *ident_list);
 size_t ident_list_count(IdentList *list);
 bool ident_list_contains(Ident ident, IdentList *list);
-Expr *new_expr_zero(bool marked);
-Expr *new_expr_num(int num, bool marked);
-Expr *new_expr_var(Ident var, bool marked);
-Expr *new_expr_sexp(ExprList *sexp, bool marked);
-Expr *new_expr_succ(Expr *inner, bool marked);
-void free_expr(Expr *expr);
-ExprList *new_expr_list(Expr *expr, ExprList *tail);
-void free_expr_list(ExprList *expr_list);
-Direct new_direct(Expr *start, Transform *transform);
-void free_direct(Direct *direct);
+Expr *new_expr_zero(void);
+Expr *new_expr_num(const Nat *num);
+Expr *new_expr_var(Ident var);
+Expr *new_expr_sexp(Expr **elements, size_t count);
+Expr *new_expr_succ(Expr *inner);
+uint64_t var_bit(Ident var);
+bool expr_may_contain(Expr *expr, Ident var);
+/* The sexp `expr` is, or nullptr if it's an atom. A numeral n is viewed as (succ n-1), which only
+ * interns n-1. The view is only good for reading the elements, it isn't the numeral. */
+Expr *expr_as_sexp(Expr *expr);
+/* The subexpression at the end of `path`. */
+Expr *expr_at_path(Expr *expr, MarkPath *path);
+Direct new_direct(Expr *start, Marks start_marks, Transform *transform);
 Induction new_induction(Ident var, Direct base, Direct step);
-void free_induction(Induction *induction);
 Proof new_proof_direct(Direct direct);
 Proof new_proof_induction(Induction induction);
-void free_proof(Proof *proof);
-Transform *new_transform_named(Ident name, bool reversed, Expr *target, Transform *next);
-Transform *new_transform_induction(Expr *target, Transform *next);
-Transform *new_transform_todo(Expr *target, Transform *next);
-void free_transform(Transform *transform);
+Transform *new_transform_named(Ident name, bool reversed, Expr *target, Marks target_marks,
+                               Transform *next);
+Transform *new_transform_induction(Expr *target, Marks target_marks, Transform *next);
+Transform *new_transform_todo(Expr *target, Marks target_marks, Transform *next);
+Transform *new_transform_simp(Expr *target, Marks target_marks, Transform *next);
 
 #endif // !AST_H
@@ -0,0 +1,429 @@
+/* Benchmarks of the verifier. Every run prints one JSON object per line:
+ *
+ *   bench corpus FILE   parses FILE and then registers and verifies its toplevels in order
+ *   bench NAME SIZE     runs the microbenchmark NAME on inputs of the given size
+ *
+ * Heap allocations are counted by wrapping malloc, calloc and realloc at link time (see the
+ * Makefile). Interned nodes are counted separately, along with the bytes of the pool they take. */
+#define _POSIX_C_SOURCE 200809L
+
+#include "ast.h"
+#include "intern.h"
+#include "parser.h"
+#include "print.h"
+#include "stack.h"
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/* microbenchmarks repeat their operation for at least this long */
+#define MIN_SECONDS 0.2
+
+static size_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+typedef struct {
+    struct timespec start;
+    size_t allocations;
+    size_t nodes;
+    size_t node_bytes;
+} Measurement;
+
+Measurement start_measurement(void) {
+    Measurement measurement = {
+        .allocations = allocations,
+        .nodes = intern_count(),
+        .node_bytes = intern_bytes(),
+    };
+    clock_gettime(CLOCK_MONOTONIC, &measurement.start);
+    return measurement;
+}
+
+double elapsed_seconds(Measurement *measurement) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - measurement->start.tv_sec) +
+           (double)(now.tv_nsec - measurement->start.tv_nsec) / 1e9;
+}
+
+void report(const char *name, size_t size, size_t ops, Measurement *measurement, bool ok) {
+    double seconds = elapsed_seconds(measurement);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"name\": \"%s\", \"size\": %zu, \"ops\": %zu, \"seconds\": %.6f, "
+           "\"ns_per_op\": %.1f, \"allocations\": %zu, \"interned_nodes\": %zu, "
+           "\"node_bytes\": %zu, \"peak_rss_kb\": %ld, \"ok\": %s}\n",
+           name, size, ops, seconds, seconds * 1e9 / (double)ops,
+           allocations - measurement->allocations, intern_count() - measurement->nodes,
+           intern_bytes() - measurement->node_bytes, usage.ru_maxrss, ok ? "true" : "false");
+}
+
+Expr *var(const char *name) { return new_expr_var(intern_ident(name, strlen(name))); }
+
+Expr *apply(Expr *head, Expr *arg) {
+    Expr *elements[] = {head, arg};
+    return new_expr_sexp(elements, 2);
+}
+
+/* (head a b) */
+Expr *apply2(Expr *head, Expr *a, Expr *b) {
+    Expr *elements[] = {head, a, b};
+    return new_expr_sexp(elements, 3);
+}
+
+/* (f (f ... (f leaf))) with `depth` applications */
+Expr *nested(size_t depth, Expr *leaf) {
+    Expr *f = var("f");
+    for (size_t i = 0; i < depth; ++i) { leaf = apply(f, leaf); }
+    return leaf;
+}
+
+Ident numbered_ident(const char *prefix, size_t i) {
+    char name[64];
+    int len = snprintf(name, sizeof(name), "%s%zu", prefix, i);
+    return intern_ident(name, len);
+}
+
+/* A pattern `depth` applications deep with a parameter at the bottom. */
+void bench_expr_matches_pattern(size_t size) {
+    IdentList *params = new_ident_list(intern_ident("a", 1), nullptr);
+    Expr *pattern = nested(size, var("a"));
+    Expr *expr = nested(size, var("x"));
+    ParamSlots slots = compile_pattern(pattern, params);
+    Expr *bindings[1];
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            bindings[0] = nullptr;
+            ok = expr_matches_pattern(expr, pattern, &slots, bindings) && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("expr_matches_pattern", size, ops, &measurement, ok);
+
+    free(slots.slots);
+}
+
+/* Visits the nodes of a term `size` applications deep in reading order, the way the verifier's
+ * traversals do. An op is one node. */
+void bench_traverse(size_t size) {
+    Expr *expr = nested(size, var("x"));
+    Stack pending = STACK_OF(Expr *);
+
+    size_t ops = 0;
+    size_t walks = 0;
+    Measurement measurement = start_measurement();
+    do {
+        *(Expr **)stack_push(&pending) = expr;
+        while (pending.count) {
+            Expr *node = *(Expr **)stack_top(&pending);
+            stack_pop(&pending);
+            ops++;
+
+            if (node->tag != EXPR_SEXP) { continue; }
+            for (size_t i = node->arity; i-- > 0;) {
+                *(Expr **)stack_push(&pending) = expr_element(node, i);
+            }
+        }
+        walks++;
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("traverse", size, ops, &measurement, ops == walks * (2 * size + 1));
+
+    stack_free(&pending);
+}
+
+/* The pattern of `expr_matches_pattern` run as a compiled program instead. */
+void bench_match_program(size_t size) {
+    IdentList *params = new_ident_list(intern_ident("a", 1), nullptr);
+    MatchOp *code = compile_match(nested(size, var("a")), params, nullptr);
+    Expr *expr = nested(size, var("x"));
+    Expr *bindings[1];
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            bindings[0] = nullptr;
+            ok = match_program(code, expr, bindings) && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("match_program", size, ops, &measurement, ok);
+
+    free(code);
+}
+
+/* (g c a) against (g c x) with c a constant `size` applications deep, walked as a tree and run as
+ * a program, which compares c by identity. */
+void bench_match_ground(size_t size) {
+    IdentList *params = new_ident_list(intern_ident("a", 1), nullptr);
+    Expr *constant = nested(size, var("y"));
+    Expr *pattern = apply2(var("g"), constant, var("a"));
+    Expr *expr = apply2(var("g"), constant, var("x"));
+    ParamSlots slots = compile_pattern(pattern, params);
+    MatchOp *code = compile_match(pattern, params, nullptr);
+    Expr *bindings[1];
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            bindings[0] = nullptr;
+            ok = expr_matches_pattern(expr, pattern, &slots, bindings) && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("match_ground_tree", size, ops, &measurement, ok);
+
+    ok = true;
+    ops = 0;
+    measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            bindings[0] = nullptr;
+            ok = match_program(code, expr, bindings) && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("match_ground_program", size, ops, &measurement, ok);
+
+    free(slots.slots);
+    free(code);
+}
+
+/* A rule with `size` parameters, (g a0 a1 ...), applied to (g (f x) (f (f x)) ...). */
+void bench_verify_rule_left(size_t size) {
+    IdentList *params = nullptr;
+    Expr **pattern = malloc((size + 1) * sizeof(Expr *));
+    Expr **expr = malloc((size + 1) * sizeof(Expr *));
+    pattern[0] = expr[0] = var("g");
+    for (size_t i = size; i > 0; --i) {
+        Ident param = numbered_ident("a", i);
+        params = new_ident_list(param, params);
+        pattern[i] = new_expr_var(param);
+        expr[i] = nested(i, var("x"));
+    }
+    Expr *lhs = new_expr_sexp(pattern, size + 1);
+    Expr *marked = new_expr_sexp(expr, size + 1);
+    free(pattern);
+    free(expr);
+    MatchOp *code = compile_match(lhs, params, nullptr);
+    Expr *bindings[MAX_RULE_PARAMS];
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            memset(bindings, 0, size * sizeof(Expr *));
+            ok = verify_rule_left(marked, code, bindings) && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("verify_rule_left", size, ops, &measurement, ok);
+
+    free(code);
+}
+
+/* Substitutes (succ y) for x at the bottom of a term `size` applications deep. */
+void bench_clone_expr_and_replace(size_t size) {
+    Expr *orig = nested(size, var("x"));
+    Expr *replacement = new_expr_succ(var("y"));
+    Expr *expected = nested(size, replacement);
+    Ident x = intern_ident("x", 1);
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            ok = clone_expr_and_replace(orig, replacement, x) == expected && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("clone_expr_and_replace", size, ops, &measurement, ok);
+}
+
+/* Looks up all rules of a table with `size` rules, round-robin. */
+void bench_find_rule(size_t size) {
+    Rules *rules = allocate_rules(size);
+    Expr *x = var("x");
+    for (size_t i = 0; i < size; ++i) {
+        add_rule(rules, numbered_ident("r", i), nullptr, x, x, 0, false);
+    }
+
+    Ident *names = malloc(size * sizeof(Ident));
+    for (size_t i = 0; i < size; ++i) { names[i] = numbered_ident("r", (i * 7919) % size); }
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < size; ++i, ++ops) { ok = find_rule(names[i], rules) && ok; }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("find_rule", size, ops, &measurement, ok);
+
+    free(names);
+    free_rules(rules);
+}
+
+/* Looks up candidates for (g k x) among `size` rules (g i a) = (h i a), one of which applies. */
+void bench_find_candidates(size_t size) {
+    Rules *rules = allocate_rules(size);
+    IdentList *params = new_ident_list(intern_ident("a", 1), nullptr);
+    for (size_t i = 0; i < size; ++i) {
+        Expr *constant = new_expr_var(numbered_ident("c", i));
+        Expr *lhs = apply2(var("g"), constant, var("a"));
+        Expr *rhs = apply2(var("h"), constant, var("a"));
+        add_rule(rules, numbered_ident("r", i), params, lhs, rhs, 0, false);
+    }
+
+    Expr *expr = apply2(var("g"), new_expr_var(numbered_ident("c", size / 2)), var("x"));
+    Stack candidates = STACK_OF(Candidate);
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            candidates.count = 0;
+            find_candidates(rules, expr, &candidates);
+            ok = candidates.count == 1 && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("find_candidates", size, ops, &measurement, ok);
+
+    stack_free(&candidates);
+    free_rules(rules);
+}
+
+/* Substitutes (succ y) for x in (add t x), where t is `size` applications deep without x. */
+void bench_clone_shared(size_t size) {
+    Expr *big = nested(size, var("y"));
+    Expr *orig = apply2(var("add"), big, var("x"));
+    Expr *replacement = new_expr_succ(var("y"));
+    Expr *expected = apply2(var("add"), big, replacement);
+    Ident x = intern_ident("x", 1);
+
+    bool ok = true;
+    size_t ops = 0;
+    Measurement measurement = start_measurement();
+    do {
+        for (size_t i = 0; i < 64; ++i, ++ops) {
+            ok = clone_expr_and_replace(orig, replacement, x) == expected && ok;
+        }
+    } while (elapsed_seconds(&measurement) < MIN_SECONDS);
+    report("clone_shared", size, ops, &measurement, ok);
+}
+
+bool collect_toplevel(TopLevel *toplevel, void *ctx) {
+    *(TopLevel *)stack_push(ctx) = *toplevel;
+    return true;
+}
+
+bool register_and_verify(TopLevel *toplevel, Rules *rules) {
+    Rules declared_before = *rules;
+    switch (toplevel->tag) {
+    case TOPLEVEL_DEFINE:
+        return verify_define(&toplevel->define, rules, 0);
+    case TOPLEVEL_THEOREM:
+        if (!register_theorem(&toplevel->theorem, rules, 0)) { return false; }
+        break;
+    case TOPLEVEL_EXAMPLE:
+        register_example(&toplevel->example);
+        break;
+    case TOPLEVEL_IMPORT:
+        return false;
+    }
+    return verify_toplevel(toplevel, &declared_before);
+}
+
+/* Reports parsing and verifying separately. Diagnostics are discarded, "ok" tells whether every
+ * toplevel verified. */
+int bench_corpus(char *filename) {
+    Stack toplevels = STACK_OF(TopLevel);
+
+    Measurement measurement = start_measurement();
+    bool parsed = !parse(filename, collect_toplevel, &toplevels);
+    report("parse", toplevels.count, toplevels.count ? toplevels.count : 1, &measurement, parsed);
+    if (!parsed) { return 1; }
+
+    FILE *discard = fopen("/dev/null", "w");
+    set_output(discard);
+
+    Rules *rules = allocate_rules(toplevels.count);
+    bool verified = true;
+    measurement = start_measurement();
+    for (size_t i = 0; i < toplevels.count && verified; ++i) {
+        verified = register_and_verify(stack_at(&toplevels, i), rules);
+    }
+    report("verify", toplevels.count, toplevels.count ? toplevels.count : 1, &measurement,
+           verified);
+
+    set_output(nullptr);
+    fclose(discard);
+    free_rules(rules);
+    stack_free(&toplevels);
+    return verified ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        void (*run)(size_t size);
+    } micro[] = {
+        {"traverse", bench_traverse},
+        {"expr_matches_pattern", bench_expr_matches_pattern},
+        {"match_program", bench_match_program},
+        {"match_ground", bench_match_ground},
+        {"verify_rule_left", bench_verify_rule_left},
+        {"clone_expr_and_replace", bench_clone_expr_and_replace},
+        {"find_rule", bench_find_rule},
+        {"find_candidates", bench_find_candidates},
+        {"clone_shared", bench_clone_shared},
+    };
+
+    bool known = false;
+    int status = 1;
+    if (argc == 3 && !strcmp(argv[1], "corpus")) {
+        known = true;
+        status = bench_corpus(argv[2]);
+    }
+    for (size_t i = 0; argc == 3 && i < sizeof(micro) / sizeof(micro[0]); ++i) {
+        if (strcmp(argv[1], micro[i].name)) { continue; }
+
+        size_t size = strtoul(argv[2], nullptr, 10);
+        micro[i].run(size ? size : 1);
+        known = true;
+        status = 0;
+    }
+
+    if (!known) { fprintf(stderr, "usage: bench corpus FILE\n       bench BENCHMARK SIZE\n"); }
+
+    free_thread_state();
+    free_ast();
+    free_symbols();
+    return status;
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+# Generates a synthetic corpus of the given KIND whose cost grows with SIZE:
+#   numerals   examples over numerals with SIZE digits
+#   chain      one proof with a `by` chain of 2 * SIZE steps
+#   theorems   SIZE theorems, each proven by the one before
+#   induction  a proof by induction over terms nested SIZE levels deep
+#   rules      SIZE rules, each used once in a shuffled order
+# usage: bench/corpus.sh KIND SIZE > corpus.pf
+
+kind=$1
+size=${2:-1000}
+
+awk -v kind="$kind" -v size="$size" '
+function repeat(s, n,    r) {
+    for (r = ""; n > 0; n = int(n / 2)) {
+        if (n % 2) { r = r s }
+        s = s s
+    }
+    return r
+}
+function ids(n, inner) { return repeat("(id ", n) inner repeat(")", n) }
+BEGIN {
+    if (kind == "numerals") {
+        print "define add-zero<a> (add a 0) = a"
+        print "define add<a b> (add a (succ b)) = (succ (add a b))"
+        digits = substr(repeat("1234567890", int(size / 10) + 1), 1, size - 1)
+        for (i = 1; i <= 100; i++) {
+            x = i digits "0"
+            y = i digits "1"
+            print "example (add " x " 1) = " y " {"
+            print "\t(add " x " 1)"
+            print "\tby add"
+            print "\t(succ [add " x " 0])"
+            print "\tby add-zero"
+            print "\t" y
+            print "}"
+        }
+    } else if (kind == "chain") {
+        print "define id<a> (id a) = a"
+        print "example x = x {"
+        print "\tx"
+        for (i = 0; i < size; i++) { print "\tby rev id (id x)\n\tby id x" }
+        print "}"
+    } else if (kind == "theorems") {
+        print "define add-zero<a> (add a 0) = a"
+        print "theorem t0<a> (add a 0) = a { by add-zero }"
+        for (i = 1; i < size; i++) { print "theorem t" i "<a> (add a 0) = a { by t" i - 1 " }" }
+    } else if (kind == "induction") {
+        print "define id<a> (id a) = a"
+        print "theorem deep<a> " ids(size, "a") " = a"
+        print "induction a {"
+        print "\tbase {"
+        print "\t\t" ids(size, "0")
+        for (i = size - 1; i >= 0; i--) { print "\t\tby id " ids(i, "0") }
+        print "\t}"
+        print "\tstep {"
+        print "\t\t" ids(size, "(succ a)")
+        for (i = size - 1; i >= 0; i--) { print "\t\tby id " ids(i, "(succ a)") }
+        print "\t}"
+        print "}"
+    } else if (kind == "rules") {
+        for (i = 0; i < size; i++) { print "define r" i "<a> (f" i " a) = a" }
+        for (i = 0; i < size; i++) {
+            j = (i * 7919) % size
+            print "example (f" j " x) = x { by r" j " }"
+        }
+    } else {
+        print "unknown corpus kind: " kind > "/dev/stderr"
+        exit 1
+    }
+}'
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Generates proofs over terms nested DEPTH levels deep (default 1000000), which only verify if no
+# traversal of the verifier recurses on the nesting depth.
+# usage: bench/deep.sh [DEPTH] > deep.pf
+
+depth=${1:-1000000}
+
+awk -v depth="$depth" '
+function repeat(s, n,    r) {
+    for (r = ""; n > 0; n = int(n / 2)) {
+        if (n % 2) { r = r s }
+        s = s s
+    }
+    return r
+}
+BEGIN {
+    opening = repeat("(f ", depth)
+    closing = repeat(")", depth)
+
+    print "define id<a> (id a) = a"
+    print "define swap<a b> (pair a b) = (pair b a)"
+    print ""
+    print "example " opening "(id x)" closing " = " opening "x" closing " {"
+    print "\t" opening "[id x]" closing
+    print "\tby id"
+    print "}"
+    print ""
+    print "example (pair " opening "x" closing " 0) = (pair 0 " opening "x" closing ") { by swap }"
+}'
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Runs every benchmark in its own process, so each reports its own peak RSS, and prints one JSON
+# object per line. Expects bench/bench to be built.
+set -e
+
+corpus() {
+    sh bench/corpus.sh "$1" "$2" > "bench/$1.pf"
+    ./bench/bench corpus "bench/$1.pf" | sed "s/^{/{\"corpus\": \"$1\", /"
+}
+
+corpus numerals 20000
+corpus chain 20000
+corpus theorems 20000
+corpus induction 1000
+corpus rules 20000
+
+for size in 10 1000 100000; do ./bench/bench traverse $size; done
+for size in 10 1000 100000; do ./bench/bench expr_matches_pattern $size; done
+for size in 10 1000 100000; do ./bench/bench match_program $size; done
+for size in 10 1000 100000; do ./bench/bench match_ground $size; done
+for size in 4 64 1024; do ./bench/bench verify_rule_left $size; done
+for size in 10 1000 10000; do ./bench/bench clone_expr_and_replace $size; done
+for size in 16 1024 65536; do ./bench/bench find_rule $size; done
+for size in 16 1024 65536; do ./bench/bench find_candidates $size; done
+for size in 10 1000 10000; do ./bench/bench clone_shared $size; done
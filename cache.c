@@ -0,0 +1,96 @@
+#include "cache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bump whenever the way keys are computed changes, so stale caches are ignored. */
+#define CACHE_HEADER "peanoforte-cache 1\n"
+
+uint64_t hash_combine(uint64_t hash, uint64_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 31;
+    hash *= 0x94d049bb133111eb;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+static size_t find_slot(const Cache *cache, uint64_t key) {
+    size_t mask = cache->capacity - 1;
+    size_t i = key & mask;
+    while (cache->slots[i] && cache->slots[i] != key) { i = (i + 1) & mask; }
+    return i;
+}
+
+static void grow(Cache *cache) {
+    Cache grown = {
+        .capacity = cache->capacity ? cache->capacity * 2 : 64,
+        .count = cache->count,
+    };
+    grown.slots = calloc(grown.capacity, sizeof(uint64_t));
+
+    for (size_t i = 0; i < cache->capacity; ++i) {
+        if (!cache->slots[i]) { continue; }
+
+        grown.slots[find_slot(&grown, cache->slots[i])] = cache->slots[i];
+    }
+
+    free(cache->slots);
+    *cache = grown;
+}
+
+void cache_add(Cache *cache, uint64_t key) {
+    if (!key) { return; }
+    if (2 * (cache->count + 1) > cache->capacity) { grow(cache); }
+
+    size_t slot = find_slot(cache, key);
+    if (!cache->slots[slot]) {
+        cache->slots[slot] = key;
+        cache->count++;
+    }
+}
+
+bool cache_contains(const Cache *cache, uint64_t key) {
+    if (!key || !cache || !cache->count) { return false; }
+
+    return cache->slots[find_slot(cache, key)] == key;
+}
+
+void cache_load(Cache *cache, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) { return; }
+
+    char header[sizeof(CACHE_HEADER)];
+    if (fgets(header, sizeof(header), file) && !strcmp(header, CACHE_HEADER)) {
+        uint64_t key;
+        while (fscanf(file, "%" SCNx64, &key) == 1) { cache_add(cache, key); }
+    }
+
+    fclose(file);
+}
+
+/* Writes to a temporary file first, so an interrupted run never leaves a truncated cache. Failing to
+ * write it only costs the next run some time, so errors are ignored. */
+void cache_save(const Cache *cache, const char *path) {
+    size_t len = strlen(path);
+    char *tmp_path = malloc(len + sizeof(".tmp"));
+    memcpy(tmp_path, path, len);
+    memcpy(tmp_path + len, ".tmp", sizeof(".tmp"));
+
+    FILE *file = fopen(tmp_path, "w");
+    if (file) {
+        fputs(CACHE_HEADER, file);
+        for (size_t i = 0; i < cache->capacity; ++i) {
+            if (cache->slots[i]) { fprintf(file, "%016" PRIx64 "\n", cache->slots[i]); }
+        }
+        if (!fclose(file)) { rename(tmp_path, path); }
+    }
+
+    free(tmp_path);
+}
+
+void cache_free(Cache *cache) {
+    free(cache->slots);
+    *cache = (Cache){0};
+}
@@ -0,0 +1,24 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Set of keys of toplevels that verified without any diagnostics, persisted between runs. A key
+ * is a content hash of a toplevel and of everything its proof depends on, so a toplevel whose key
+ * is cached doesn't need to be verified again. 0 is never a valid key. */
+typedef struct {
+    uint64_t *slots;
+    size_t capacity;
+    size_t count;
+} Cache;
+
+uint64_t hash_combine(uint64_t hash, uint64_t value);
+void cache_add(Cache *cache, uint64_t key);
+bool cache_contains(const Cache *cache, uint64_t key);
+/* A missing or unreadable cache file leaves `cache` empty. */
+void cache_load(Cache *cache, const char *path);
+void cache_save(const Cache *cache, const char *path);
+void cache_free(Cache *cache);
+
+#endif // !CACHE_H
@@ -0,0 +1,266 @@
+#include "dtree.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Symbols are packed in a key, the kind in the top byte. A sexp is keyed by its length, its
+ * elements follow it in preorder. */
+enum {
+    KEY_SEXP = 1,
+    KEY_VAR,
+    KEY_ZERO,
+    KEY_NUM,
+};
+
+#define KEY(kind, value) ((uint64_t)(kind) << 56 | (uint64_t)(value))
+
+/* ends a list of entries */
+#define NO_ENTRY SIZE_MAX
+/* the root is never a child, so it marks a missing one */
+#define NO_NODE 0
+
+typedef struct {
+    size_t star; /* child for a parameter */
+    size_t first;
+    size_t last;
+} Node;
+
+typedef struct {
+    size_t value;
+    size_t next;
+} Entry;
+
+typedef struct {
+    uint64_t key;
+    size_t parent;
+    size_t child; /* NO_NODE marks an empty slot */
+} Edge;
+
+struct _DTree {
+    Stack nodes;
+    Stack entries;
+    Edge *edges; /* open-addressing hash table over (parent, key) */
+    size_t edge_capacity;
+    size_t edge_count;
+};
+
+/* The handles of the elements of a sexp still to be looked up. */
+typedef struct {
+    const uint32_t *next;
+    size_t left;
+} Elements;
+
+typedef struct _Pending {
+    Elements elements;
+    struct _Pending *up;
+} Pending;
+
+/* A position in the trie and the expressions still to be looked up from there. */
+typedef struct {
+    size_t node;
+    Elements elements;
+    Pending *up; /* the rest of the enclosing sexps */
+} LookupState;
+
+static thread_local Stack lookup_states = STACK_OF(LookupState);
+static thread_local Arena lookup_arena;
+
+size_t new_node(DTree *tree) {
+    *(Node *)stack_push(&tree->nodes) = (Node){
+        .star = NO_NODE,
+        .first = NO_ENTRY,
+        .last = NO_ENTRY,
+    };
+    return tree->nodes.count - 1;
+}
+
+DTree *dtree_new(void) {
+    DTree *tree = malloc(sizeof(DTree));
+    *tree = (DTree){
+        .nodes = STACK_OF(Node),
+        .entries = STACK_OF(Entry),
+    };
+    new_node(tree);
+    return tree;
+}
+
+void dtree_free(DTree *tree) {
+    if (!tree) { return; }
+    stack_free(&tree->nodes);
+    stack_free(&tree->entries);
+    free(tree->edges);
+    free(tree);
+}
+
+size_t edge_slot(DTree *tree, size_t parent, uint64_t key) {
+    uint64_t hash = key ^ (parent * 0x9e3779b97f4a7c15);
+    hash ^= hash >> 29;
+    hash *= 0xbf58476d1ce4e5b9;
+    hash ^= hash >> 32;
+
+    size_t mask = tree->edge_capacity - 1;
+    size_t i = hash & mask;
+    while (tree->edges[i].child != NO_NODE &&
+           (tree->edges[i].parent != parent || tree->edges[i].key != key)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+size_t find_child(DTree *tree, size_t parent, uint64_t key) {
+    if (!tree->edge_count) { return NO_NODE; }
+    return tree->edges[edge_slot(tree, parent, key)].child;
+}
+
+void grow_edges(DTree *tree) {
+    Edge *edges = tree->edges;
+    size_t capacity = tree->edge_capacity;
+
+    tree->edge_capacity = capacity ? 2 * capacity : 64;
+    tree->edges = calloc(tree->edge_capacity, sizeof(Edge));
+    for (size_t i = 0; i < capacity; ++i) {
+        if (edges[i].child == NO_NODE) { continue; }
+        tree->edges[edge_slot(tree, edges[i].parent, edges[i].key)] = edges[i];
+    }
+    free(edges);
+}
+
+size_t add_child(DTree *tree, size_t parent, uint64_t key) {
+    size_t child = find_child(tree, parent, key);
+    if (child != NO_NODE) { return child; }
+
+    if (2 * (tree->edge_count + 1) > tree->edge_capacity) { grow_edges(tree); }
+    child = new_node(tree);
+    tree->edges[edge_slot(tree, parent, key)] = (Edge){
+        .key = key,
+        .parent = parent,
+        .child = child,
+    };
+    tree->edge_count++;
+    return child;
+}
+
+uint64_t symbol_key(Expr *expr) {
+    switch (expr->tag) {
+    case EXPR_ZERO:
+        return KEY(KEY_ZERO, 0);
+    case EXPR_NUM:
+        return KEY(KEY_NUM, expr_handle(expr));
+    case EXPR_VAR:
+        return KEY(KEY_VAR, expr->var);
+    case EXPR_SEXP:
+        return KEY(KEY_SEXP, expr->arity);
+    }
+    return 0;
+}
+
+void dtree_insert(DTree *tree, Expr *pattern, IdentList *params, size_t value) {
+    Stack pending = STACK_OF(Expr *);
+    *(Expr **)stack_push(&pending) = pattern;
+    size_t node = 0;
+
+    while (pending.count) {
+        Expr *expr = *(Expr **)stack_top(&pending);
+        stack_pop(&pending);
+
+        if (expr->tag == EXPR_VAR && ident_list_contains(expr->var, params)) {
+            size_t star = ((Node *)stack_at(&tree->nodes, node))->star;
+            if (star == NO_NODE) {
+                star = new_node(tree);
+                ((Node *)stack_at(&tree->nodes, node))->star = star;
+            }
+            node = star;
+            continue;
+        }
+
+        node = add_child(tree, node, symbol_key(expr));
+        if (expr->tag != EXPR_SEXP) { continue; }
+
+        /* the elements are popped in reading order */
+        for (size_t i = expr->arity; i-- > 0;) {
+            *(Expr **)stack_push(&pending) = expr_element(expr, i);
+        }
+    }
+    stack_free(&pending);
+
+    *(Entry *)stack_push(&tree->entries) = (Entry){
+        .value = value,
+        .next = NO_ENTRY,
+    };
+    size_t entry = tree->entries.count - 1;
+    Node *leaf = stack_at(&tree->nodes, node);
+    if (leaf->last == NO_ENTRY) {
+        leaf->first = entry;
+    } else {
+        ((Entry *)stack_at(&tree->entries, leaf->last))->next = entry;
+    }
+    leaf->last = entry;
+}
+
+void push_lookup_state(size_t node, Elements elements, Pending *up) {
+    *(LookupState *)stack_push(&lookup_states) = (LookupState){
+        .node = node,
+        .elements = elements,
+        .up = up,
+    };
+}
+
+/* Continues the lookup with the elements of `sexp`, and then with `rest`. */
+void push_sexp_state(size_t node, Expr *sexp, Elements rest, Pending *up) {
+    Pending *pending = arena_alloc(&lookup_arena, sizeof(Pending));
+    *pending = (Pending){
+        .elements = rest,
+        .up = up,
+    };
+    push_lookup_state(node, (Elements){sexp->elements, sexp->arity}, pending);
+}
+
+void dtree_lookup(DTree *tree, Expr *expr, Stack *values) {
+    uint32_t root = expr_handle(expr);
+    size_t base = lookup_states.count;
+    push_lookup_state(0, (Elements){&root, 1}, nullptr);
+
+    while (lookup_states.count > base) {
+        LookupState state = *(LookupState *)stack_top(&lookup_states);
+        stack_pop(&lookup_states);
+
+        while (!state.elements.left && state.up) {
+            state.elements = state.up->elements;
+            state.up = state.up->up;
+        }
+
+        Node *node = stack_at(&tree->nodes, state.node);
+        if (!state.elements.left) {
+            for (size_t i = node->first; i != NO_ENTRY;) {
+                Entry *entry = stack_at(&tree->entries, i);
+                *(size_t *)stack_push(values) = entry->value;
+                i = entry->next;
+            }
+            continue;
+        }
+
+        Expr *term = expr_at(*state.elements.next);
+        Elements rest = {state.elements.next + 1, state.elements.left - 1};
+        if (node->star != NO_NODE) { push_lookup_state(node->star, rest, state.up); }
+
+        size_t child = find_child(tree, state.node, symbol_key(term));
+        if (child != NO_NODE && term->tag == EXPR_SEXP) {
+            push_sexp_state(child, term, rest, state.up);
+        } else if (child != NO_NODE) {
+            push_lookup_state(child, rest, state.up);
+        }
+
+        /* a numeral n also matches patterns of (succ n-1) */
+        if (term->tag == EXPR_NUM) {
+            child = find_child(tree, state.node, KEY(KEY_SEXP, 2));
+            if (child != NO_NODE) { push_sexp_state(child, expr_as_sexp(term), rest, state.up); }
+        }
+    }
+
+    arena_reset(&lookup_arena);
+}
+
+void free_dtree_state(void) {
+    stack_free(&lookup_states);
+    arena_free(&lookup_arena);
+}
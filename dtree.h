@@ -0,0 +1,25 @@
+#ifndef DTREE_H
+#define DTREE_H
+
+#include "ast.h"
+#include "stack.h"
+
+#include <stddef.h>
+
+/* Discrimination tree: a trie over the symbols of patterns in preorder, where a parameter is a
+ * wildcard standing for a whole subexpression. A lookup walks the trie along the symbols of an
+ * expression and takes the wildcard edges on the side, so its cost depends on the expression and
+ * the shapes of the patterns but not on how many patterns there are.
+ * Found patterns are only candidates: a parameter used twice isn't checked, that's up to the
+ * matcher. Lookups may run concurrently, inserting may not. */
+typedef struct _DTree DTree;
+
+DTree *dtree_new(void);
+void dtree_free(DTree *tree);
+void dtree_insert(DTree *tree, Expr *pattern, IdentList *params, size_t value);
+/* Pushes the value of every pattern that may match `expr` onto `values`, a stack of size_t. */
+void dtree_lookup(DTree *tree, Expr *expr, Stack *values);
+/* Releases the calling thread's lookup state. */
+void free_dtree_state(void);
+
+#endif // !DTREE_H
@@ -2,16 +2,18 @@ if exists("b:current_syntax")
 	finish
 end
 
-syn keyword peanoforteKeyword define theorem example base step induction by rev todo
+syn keyword peanoforteKeyword define theorem example base step induction by rev simp todo import
 syn keyword peanoforteOperator succ
 syn keyword peanoforteZero 0
 syn match peanoforteNumber "\<[1-9][0-9]*\>"
 syn region peanoforteComment start=";" end="\n"
+syn region peanoforteString start=+"+ end=+"+ oneline
 
 hi def link peanoforteKeyword Keyword
 hi def link peanoforteOperator Operator
 hi def link peanoforteZero Special
 hi def link peanoforteNumber Number
 hi def link peanoforteComment Comment
+hi def link peanoforteString String
 
 let b:current_syntax = "peanoforte"
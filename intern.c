@@ -0,0 +1,330 @@
+#define _DEFAULT_SOURCE
+
+#include "intern.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <threads.h>
+
+#define TABLE_INITIAL_CAPACITY 1024
+
+/* Handles address 2^32 units of 8 bytes. The pool reserves as much of that as the system lets it
+ * up front, so nodes never move, and pages are only backed once nodes are allocated in them. */
+#define POOL_MAX_BYTES ((size_t)1 << 35)
+#define POOL_MIN_BYTES ((size_t)1 << 24)
+
+typedef struct {
+    uint32_t *slots; /* handles, 0 marks an empty slot */
+    size_t capacity;
+    size_t count;
+} Table;
+
+/* A numeral's (succ n-1) view, looked up by the numeral's handle. */
+typedef struct {
+    uint32_t num;
+    uint32_t view;
+} ViewEntry;
+
+/* Verification threads intern concurrently, everything below is guarded by `lock`. Nodes are
+ * never written once they're in the pool, so reading them needs no lock. */
+static mtx_t lock;
+static once_flag lock_once = ONCE_FLAG_INIT;
+
+static Table expr_table;
+static ViewEntry *views;
+static size_t views_capacity;
+static size_t views_count;
+
+unsigned char *expr_pool;
+static size_t pool_capacity; /* in bytes */
+static size_t pool_used = 8; /* handle 0 is never a node */
+
+/* the values of numerals */
+static Arena numerals;
+
+/* temporary numeral values, reset after every use */
+static Arena nat_scratch;
+
+static void init_lock(void) { mtx_init(&lock, mtx_plain); }
+
+static void acquire(void) {
+    call_once(&lock_once, init_lock);
+    mtx_lock(&lock);
+}
+
+static void release(void) { mtx_unlock(&lock); }
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111eb;
+    h ^= h >> 31;
+    return h;
+}
+
+static void reserve_pool(void) {
+    for (size_t size = POOL_MAX_BYTES; size >= POOL_MIN_BYTES; size /= 2) {
+        void *pool = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (pool != MAP_FAILED) {
+            expr_pool = pool;
+            pool_capacity = size;
+            return;
+        }
+    }
+}
+
+static Expr *pool_alloc(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (!expr_pool) { reserve_pool(); }
+    if (pool_used + size > pool_capacity) {
+        fputs("** ERROR ** Out of memory for expressions.\n", stderr);
+        exit(1);
+    }
+
+    Expr *expr = (Expr *)(expr_pool + pool_used);
+    pool_used += size;
+    return expr;
+}
+
+static uint64_t hash_atom(Expr *key) {
+    uint64_t h = 0;
+    switch (key->tag) {
+    case EXPR_ZERO:
+        break;
+    case EXPR_NUM:
+        h = nat_hash(key->num);
+        break;
+    case EXPR_VAR:
+        h = ident_hash(key->var);
+        break;
+    case EXPR_SEXP:
+        break;
+    }
+    return mix(h ^ ((uint64_t)key->tag << 1));
+}
+
+static uint64_t hash_sexp(Expr **elements, size_t count) {
+    uint64_t h = count;
+    for (size_t i = 0; i < count; ++i) { h = mix(h * 31 + elements[i]->hash); }
+    return mix(h ^ ((uint64_t)EXPR_SEXP << 1));
+}
+
+static bool atom_equals(Expr *a, Expr *b) {
+    if (a->tag != b->tag) { return false; }
+
+    switch (a->tag) {
+    case EXPR_ZERO:
+        return true;
+    case EXPR_NUM:
+        return nat_equals(a->num, b->num);
+    case EXPR_VAR:
+        return a->var == b->var;
+    case EXPR_SEXP:
+        return false;
+    }
+    return false;
+}
+
+static bool sexp_equals(Expr *sexp, Expr **elements, size_t count) {
+    if (sexp->tag != EXPR_SEXP || sexp->arity != count) { return false; }
+    for (size_t i = 0; i < count; ++i) {
+        if (expr_at(sexp->elements[i]) != elements[i]) { return false; }
+    }
+    return true;
+}
+
+static void table_grow(Table *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : TABLE_INITIAL_CAPACITY;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+
+    for (size_t i = 0; i < table->capacity; ++i) {
+        uint32_t entry = table->slots[i];
+        if (!entry) { continue; }
+
+        size_t j = expr_at(entry)->hash & (capacity - 1);
+        while (slots[j]) { j = (j + 1) & (capacity - 1); }
+        slots[j] = entry;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+}
+
+/* The slot of the table to look for a node with `hash` in. */
+static size_t first_slot(uint64_t hash) {
+    if (2 * (expr_table.count + 1) > expr_table.capacity) { table_grow(&expr_table); }
+    return hash & (expr_table.capacity - 1);
+}
+
+static Expr *add_to_table(size_t slot, Expr *expr) {
+    expr_table.slots[slot] = expr_handle(expr);
+    expr_table.count++;
+    return expr;
+}
+
+static Expr *insert_atom(const Expr *atom) {
+    Expr key = *atom;
+    key.hash = hash_atom(&key);
+    key.vars = key.tag == EXPR_VAR ? var_bit(key.var) : 0;
+
+    size_t i = first_slot(key.hash);
+    size_t mask = expr_table.capacity - 1;
+    for (uint32_t entry; (entry = expr_table.slots[i]); i = (i + 1) & mask) {
+        Expr *expr = expr_at(entry);
+        if (expr->hash == key.hash && atom_equals(expr, &key)) { return expr; }
+    }
+
+    Expr *expr = pool_alloc(sizeof(Expr));
+    *expr = key;
+    if (key.tag == EXPR_NUM) { expr->num = nat_copy(&numerals, key.num); }
+    return add_to_table(i, expr);
+}
+
+static Expr *insert_numeral(const Nat *num) {
+    if (nat_is_zero(num)) { return insert_atom(&(Expr){.tag = EXPR_ZERO}); }
+
+    return insert_atom(&(Expr){
+        .tag = EXPR_NUM,
+        .num = num,
+    });
+}
+
+static bool is_numeral_succ(Expr **elements, size_t count) {
+    if (count != 2 || elements[0]->tag != EXPR_VAR || elements[0]->var != ident_succ()) {
+        return false;
+    }
+    return elements[1]->tag == EXPR_ZERO || elements[1]->tag == EXPR_NUM;
+}
+
+static Expr *insert_sexp(Expr **elements, size_t count) {
+    if (is_numeral_succ(elements, count)) {
+        static const Nat zero = {0};
+        const Nat *num = elements[1]->tag == EXPR_NUM ? elements[1]->num : &zero;
+        Expr *succ = insert_numeral(nat_succ(&nat_scratch, num));
+        arena_reset(&nat_scratch);
+        return succ;
+    }
+
+    uint64_t hash = hash_sexp(elements, count);
+    size_t i = first_slot(hash);
+    size_t mask = expr_table.capacity - 1;
+    for (uint32_t entry; (entry = expr_table.slots[i]); i = (i + 1) & mask) {
+        Expr *expr = expr_at(entry);
+        if (expr->hash == hash && sexp_equals(expr, elements, count)) { return expr; }
+    }
+
+    Expr *expr = pool_alloc(sizeof(Expr) + count * sizeof(uint32_t));
+    *expr = (Expr){
+        .tag = EXPR_SEXP,
+        .arity = count,
+        .hash = hash,
+    };
+    for (size_t j = 0; j < count; ++j) {
+        expr->elements[j] = expr_handle(elements[j]);
+        expr->vars |= elements[j]->vars;
+    }
+    return add_to_table(i, expr);
+}
+
+Expr *intern_expr(const Expr *key) {
+    acquire();
+    Expr *expr = insert_atom(key);
+    release();
+    return expr;
+}
+
+Expr *intern_sexp(Expr **elements, size_t count) {
+    acquire();
+    Expr *expr = insert_sexp(elements, count);
+    release();
+    return expr;
+}
+
+Expr *numeral_pred(Expr *num) {
+    acquire();
+    Expr *pred = insert_numeral(nat_pred(&nat_scratch, num->num));
+    arena_reset(&nat_scratch);
+    release();
+    return pred;
+}
+
+static size_t view_slot(uint32_t num) {
+    size_t mask = views_capacity - 1;
+    size_t i = mix(num) & mask;
+    while (views[i].num && views[i].num != num) { i = (i + 1) & mask; }
+    return i;
+}
+
+static void grow_views(void) {
+    ViewEntry *entries = views;
+    size_t capacity = views_capacity;
+
+    views_capacity = capacity ? 2 * capacity : TABLE_INITIAL_CAPACITY;
+    views = calloc(views_capacity, sizeof(ViewEntry));
+    for (size_t i = 0; i < capacity; ++i) {
+        if (entries[i].num) { views[view_slot(entries[i].num)] = entries[i]; }
+    }
+    free(entries);
+}
+
+/* Views are sexps outside the table, so interning (succ n-1) still yields the numeral. */
+Expr *numeral_view(Expr *num) {
+    uint32_t handle = expr_handle(num);
+
+    acquire();
+    if (2 * (views_count + 1) > views_capacity) { grow_views(); }
+    size_t slot = view_slot(handle);
+    if (!views[slot].num) {
+        Expr *succ = insert_atom(&(Expr){.tag = EXPR_VAR, .var = ident_succ()});
+        Expr *pred = insert_numeral(nat_pred(&nat_scratch, num->num));
+        arena_reset(&nat_scratch);
+
+        Expr *view = pool_alloc(sizeof(Expr) + 2 * sizeof(uint32_t));
+        *view = (Expr){
+            .tag = EXPR_SEXP,
+            .arity = 2,
+            .hash = num->hash,
+            .vars = num->vars,
+        };
+        view->elements[0] = expr_handle(succ);
+        view->elements[1] = expr_handle(pred);
+        views[slot] = (ViewEntry){.num = handle, .view = expr_handle(view)};
+        views_count++;
+    }
+    Expr *view = expr_at(views[slot].view);
+    release();
+    return view;
+}
+
+size_t intern_count(void) {
+    acquire();
+    size_t count = expr_table.count;
+    release();
+    return count;
+}
+
+size_t intern_bytes(void) {
+    acquire();
+    size_t bytes = pool_used;
+    release();
+    return bytes;
+}
+
+void free_intern_tables(void) {
+    free(expr_table.slots);
+    expr_table = (Table){0};
+    free(views);
+    views = nullptr;
+    views_capacity = views_count = 0;
+    if (expr_pool) { munmap(expr_pool, pool_capacity); }
+    expr_pool = nullptr;
+    pool_capacity = 0;
+    pool_used = 8;
+    arena_free(&numerals);
+    arena_free(&nat_scratch);
+}
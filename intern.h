@@ -0,0 +1,21 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "ast.h"
+
+/* Hash-consing of expressions. `intern_expr` and `intern_sexp` look up a node equal to the given
+ * atom or sexp (elements are compared by handle, as they are interned already) and allocate it if
+ * it doesn't exist yet. A NUM key's value is copied into the table on insertion, so it may be
+ * temporary. */
+Expr *intern_expr(const Expr *key);
+Expr *intern_sexp(Expr **elements, size_t count);
+Expr *numeral_pred(Expr *num);
+/* The (succ n-1) view of the numeral `num`, see `expr_as_sexp`. */
+Expr *numeral_view(Expr *num);
+size_t intern_count(void);
+/* The bytes of the pool taken by interned nodes. */
+size_t intern_bytes(void);
+/* Releases the tables along with every interned node. */
+void free_intern_tables(void);
+
+#endif // !INTERN_H
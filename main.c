@@ -1,565 +1,868 @@
+#define _XOPEN_SOURCE 700
+
 #include "ast.h"
+#include "cache.h"
+#include "native.h"
 #include "parser.h"
+#include "pool.h"
 #include "print.h"
-
+#include "search.h"
+#include "stack.h"
+#include "stats.h"
+#include "trace.h"
+#include "verify.h"
+
+#include <errno.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <unistd.h>
 
+/* A parsed file. Its rules are allocated when it's registered, after the modules it imports. */
 typedef struct {
-    Ident name;
-    IdentList *params;
-    Expr *lhs;
-    Expr *rhs;
-} Rule;
+    char *path; /* canonical, identifies the module */
+    Program *program;
+    Rules *rules;
+} Module;
 
-typedef struct {
-    size_t count;
-    Rule rules[];
-} Rules;
+/* Every module loaded by this process, each one after the modules it imports. The file given on
+ * the command line is the last one. */
+static Stack modules = STACK_OF(Module);
+
+Module *module_at(size_t index) { return stack_at(&modules, index); }
+
+/* The module given on the command line, if it was loaded as one. */
+static size_t main_module = SIZE_MAX;
+
+/* Imports are resolved relative to the directory of the importing file. */
+char *import_path(const char *importer, const char *path) {
+    const char *slash = strrchr(importer, '/');
+    size_t dir_len = path[0] != '/' && slash ? slash - importer + 1 : 0;
+    size_t path_len = strlen(path);
+
+    char *joined = malloc(dir_len + path_len + 1);
+    memcpy(joined, importer, dir_len);
+    memcpy(joined + dir_len, path, path_len + 1);
+    return joined;
+}
 
 typedef struct {
-    Expr *lhs;
-    Expr *rhs;
-} InductionRule;
+    Program *head;
+    Program **tail;
+} ProgramBuilder;
+
+bool append_toplevel(TopLevel *toplevel, void *ctx) {
+    ProgramBuilder *builder = ctx;
+    *builder->tail = new_program(*toplevel, nullptr);
+    builder->tail = &(*builder->tail)->rest;
+    return true;
+}
 
+/* A file found while loading, before it's put among the modules. While loading, the `module` of
+ * an import is the index of the imported source. */
 typedef struct {
-    Ident param;
-    Expr *expr;
-} Binding;
+    char *path; /* canonical */
+    Program *program;
+    FILE *stream;
+    char *report;
+    size_t report_size;
+    bool parsed;
+    enum {
+        SOURCE_NEW,
+        SOURCE_VISITING,
+        SOURCE_DONE,
+    } state;
+    size_t module; /* the index in `modules`, once it's done */
+} Source;
 
 typedef struct {
-    size_t count;
-    Binding bindings[];
-} Bindings;
-
-/* forward declarations */
-Expr *find_marked_expr(Expr *expr);
-void unmark_expr(Expr *expr);
-bool expr_matches_pattern(Expr *expr, Expr *pattern, IdentList *params, Bindings *bindings);
-Expr *clone_expr_and_replace(Expr *orig, Expr *replacement, Ident param);
-bool verify_rule_left(Expr *expr, Expr *pattern, IdentList *params, Bindings *bindings);
-bool verify_rule_right(Expr *expr, Expr *marked, Expr *replace, Expr *target, IdentList *params,
-                       Bindings *bindings);
-bool verify_proof(Proof *proof, IdentList *params, Expr *lhs, Expr *rhs, Rules *rules);
-
-Rules *allocate_rules(size_t len) {
-    Rules *rules = malloc(sizeof(Rules) + len * sizeof(Rule));
-    rules->count = 0;
-    return rules;
-}
-
-void add_rule(Rules *rules, Ident name, IdentList *params, Expr *lhs, Expr *rhs) {
-    rules->rules[rules->count] = (Rule){
-        .name = name,
-        .params = params,
-        .lhs = lhs,
-        .rhs = rhs,
-    };
-    rules->count++;
-}
+    Stack *sources;
+    size_t begin;
+} Wave;
 
-Rule *find_rule(Ident name, Rules *rules) {
-    for (size_t i = 0; i < rules->count; ++i) {
-        Rule rule = rules->rules[i];
-        if (!strcmp(name, rule.name)) { return &rules->rules[i]; }
-    }
-    return nullptr;
-}
+void parse_source(void *ctx, size_t job) {
+    Wave *wave = ctx;
+    Source *source = stack_at(wave->sources, wave->begin + job);
+    if (source->state == SOURCE_DONE) { return; }
 
-Bindings *allocate_bindings(size_t len) {
-    Bindings *bindings = malloc(sizeof(Bindings) + len * sizeof(Binding));
-    bindings->count = 0;
-    return bindings;
-}
+    source->stream = open_memstream(&source->report, &source->report_size);
+    set_output(source->stream);
 
-void add_binding(Bindings *bindings, Ident param, Expr *expr) {
-    bindings->bindings[bindings->count] = (Binding){
-        .param = param,
-        .expr = expr,
-    };
-    bindings->count++;
-}
+    ProgramBuilder builder = {.tail = &builder.head};
+    source->parsed = !parse(source->path, append_toplevel, &builder);
+    source->program = builder.head;
 
-Binding *find_binding(Ident name, Bindings *bindings) {
-    if (!bindings) { return nullptr; }
+    set_output(nullptr);
+    fclose(source->stream);
+}
 
-    for (size_t i = 0; i < bindings->count; ++i) {
-        Binding binding = bindings->bindings[i];
-        if (!strcmp(name, binding.param)) { return &bindings->bindings[i]; }
-    }
-    return nullptr;
+/* The canonical path of `path`. Pipes, like those of process substitution, have no path to
+ * resolve to, so they're identified by the name they were given. */
+char *canonical_path(const char *path) {
+    char *canonical = realpath(path, nullptr);
+    if (!canonical && !access(path, R_OK)) { canonical = strdup(path); }
+    return canonical;
 }
 
-void debug_bindings(Bindings *bindings) {
-    for (size_t i = 0; i < bindings->count; ++i) {
-        Binding binding = bindings->bindings[i];
-        printf("DEBUG: %s -> ", binding.param);
-        print_expr(binding.expr);
+/* Finds the source with the canonical path of `path`, adding it if it's new. */
+bool find_source(const char *path, Stack *sources, size_t *index) {
+    char *canonical = canonical_path(path);
+    if (!canonical) {
+        output("** ERROR ** Can't read file %s.\n", path);
+        return false;
     }
-}
 
-void warn_more_marked_exprs(ExprList *list) {
-    if (!list) { return; }
-    if (find_marked_expr(list->head)) {
-        printf("** WARN ** More than one subexpression marked: ");
-        print_expr(list->head);
-        unmark_expr(list->head);
+    for (size_t i = 0; i < sources->count; ++i) {
+        if (!strcmp(((Source *)stack_at(sources, i))->path, canonical)) {
+            free(canonical);
+            *index = i;
+            return true;
+        }
     }
-    return warn_more_marked_exprs(list->tail);
-}
 
-Expr *find_marked_expr_in_list(ExprList *list) {
-    if (!list) { return nullptr; }
+    *index = sources->count;
+    Source *source = stack_push(sources);
+    *source = (Source){.path = canonical};
 
-    Expr *marked;
-    if ((marked = find_marked_expr(list->head))) {
-        warn_more_marked_exprs(list->tail);
-        return marked;
+    /* modules loaded before are reused as they are */
+    for (size_t i = 0; i < modules.count; ++i) {
+        if (!strcmp(module_at(i)->path, canonical)) {
+            source->state = SOURCE_DONE;
+            source->module = i;
+        }
     }
-    return find_marked_expr_in_list(list->tail);
+    return true;
 }
 
-Expr *find_marked_expr(Expr *expr) {
-    if (!expr) { return nullptr; }
+/* Appends the modules imported by `index` and then the module itself, in dependency order. */
+bool order_source(Stack *sources, size_t index) {
+    Source *source = stack_at(sources, index);
+    source->state = SOURCE_VISITING;
 
-    Expr *found = nullptr;
-    if (expr->marked) { found = expr; }
+    for (Program *rest = source->program; rest; rest = rest->rest) {
+        if (rest->toplevel.tag != TOPLEVEL_IMPORT) { continue; }
 
-    switch (expr->tag) {
-    case EXPR_ZERO:
-    case EXPR_VAR:
-        break;
-    case EXPR_SEXP:
-        if (found) {
-            warn_more_marked_exprs(expr->sexp);
-        } else {
-            found = find_marked_expr_in_list(expr->sexp);
+        Source *imported = stack_at(sources, rest->toplevel.import.module);
+        if (imported->state == SOURCE_VISITING) {
+            output("** ERROR ** Import cycle through %s.\n", imported->path);
+            return false;
+        }
+        if (imported->state == SOURCE_NEW &&
+            !order_source(sources, rest->toplevel.import.module)) {
+            return false;
         }
-        break;
     }
 
-    return found;
-}
-
-void unmark_expr_list(ExprList *list) {
-    if (!list) { return; }
-    unmark_expr(list->head);
-    unmark_expr_list(list->tail);
+    source = stack_at(sources, index);
+    source->state = SOURCE_DONE;
+    source->module = modules.count;
+    *(Module *)stack_push(&modules) = (Module){
+        .path = source->path,
+        .program = source->program,
+    };
+    source->path = nullptr;
+    return true;
 }
 
-void unmark_expr(Expr *expr) {
-    if (!expr) { return; }
-    if (expr->marked) { expr->marked = false; }
+/* Loads the file at `path` and everything it imports that isn't loaded yet, appending the new
+ * modules to `modules` after their imports. The files are parsed in waves on `threads` threads:
+ * first the given one, then everything it imports, then everything those import, and so on. The
+ * index of the module is stored in `index`. */
+bool load_modules(const char *path, size_t threads, size_t *index) {
+    Stack sources = STACK_OF(Source);
+    size_t root;
+    bool loaded = find_source(path, &sources, &root);
+
+    for (size_t begin = 0; loaded && begin < sources.count;) {
+        size_t end = sources.count;
+        Wave wave = {.sources = &sources, .begin = begin};
+        pool_run(end - begin, threads, parse_source, trace_flush, &wave);
+
+        for (size_t i = begin; i < end; ++i) {
+            Source *source = stack_at(&sources, i);
+            if (source->state == SOURCE_DONE) { continue; }
+
+            if (loaded) { fwrite(source->report, 1, source->report_size, stdout); }
+            free(source->report);
+            loaded = loaded && source->parsed;
+        }
 
-    if (expr->tag == EXPR_SEXP) { unmark_expr_list(expr->sexp); }
-}
+        for (size_t i = begin; i < end && loaded; ++i) {
+            Source *source = stack_at(&sources, i);
+            for (Program *rest = source->program; rest && loaded; rest = rest->rest) {
+                if (rest->toplevel.tag != TOPLEVEL_IMPORT) { continue; }
 
-ExprList *clone_expr_list_and_replace(ExprList *orig, Expr *replacement, Ident param) {
-    if (!orig) { return nullptr; }
+                Import *import = &rest->toplevel.import;
+                char *imported = import_path(((Source *)stack_at(&sources, i))->path, import->path);
+                loaded = find_source(imported, &sources, &import->module);
+                free(imported);
+            }
+        }
+        begin = end;
+    }
 
-    Expr *new_head = clone_expr_and_replace(orig->head, replacement, param);
-    ExprList *new_tail = clone_expr_list_and_replace(orig->tail, replacement, param);
+    Source *root_source = stack_at(&sources, root);
+    loaded = loaded && (root_source->state == SOURCE_DONE || order_source(&sources, root));
 
-    return new_expr_list(new_head, new_tail);
-}
+    /* imports now refer to modules, the sources that were parsed just now are modules too */
+    for (size_t i = 0; i < sources.count && loaded; ++i) {
+        Source *source = stack_at(&sources, i);
+        if (source->path) { continue; }
 
-Expr *clone_expr_and_replace(Expr *orig, Expr *replacement, Ident param) {
-    if (!orig) { return nullptr; }
+        for (Program *rest = source->program; rest; rest = rest->rest) {
+            if (rest->toplevel.tag != TOPLEVEL_IMPORT) { continue; }
 
-    switch (orig->tag) {
-    case EXPR_ZERO:
-        return new_expr_zero(orig->marked);
-    case EXPR_VAR:
-        if (replacement) {
-            if (!strcmp(orig->var, param)) {
-                return clone_expr_and_replace(replacement, nullptr, nullptr);
-            }
+            Import *import = &rest->toplevel.import;
+            import->module = ((Source *)stack_at(&sources, import->module))->module;
         }
-        return new_expr_var(strdup(orig->var), orig->marked);
-    case EXPR_SEXP:
-        ExprList *sexp = clone_expr_list_and_replace(orig->sexp, replacement, param);
-        return new_expr_sexp(sexp, orig->marked);
     }
+    if (loaded) { *index = ((Source *)stack_at(&sources, root))->module; }
 
-    return nullptr;
+    for (size_t i = 0; i < sources.count; ++i) { free(((Source *)stack_at(&sources, i))->path); }
+    stack_free(&sources);
+    return loaded;
 }
 
-bool expr_equals(Expr *a, Expr *b) { return expr_matches_pattern(a, b, nullptr, nullptr); }
-
-bool expr_list_matches_pattern(ExprList *expr_list, ExprList *pattern_list, IdentList *params,
-                               Bindings *bindings) {
-    if (!expr_list) { return !pattern_list; }
-    if (!pattern_list) { return !expr_list; }
-
-    if (expr_matches_pattern(expr_list->head, pattern_list->head, params, bindings)) {
-        return expr_list_matches_pattern(expr_list->tail, pattern_list->tail, params, bindings);
+void free_modules(void) {
+    for (size_t i = 0; i < modules.count; ++i) {
+        free(module_at(i)->path);
+        free_rules(module_at(i)->rules);
     }
+    stack_free(&modules);
+}
 
-    return false;
+/* The number of rules a toplevel registers at most. Imported modules have to be registered. */
+size_t count_toplevel_rules(TopLevel *toplevel) {
+    switch (toplevel->tag) {
+    case TOPLEVEL_DEFINE:
+    case TOPLEVEL_THEOREM:
+        return 1;
+    case TOPLEVEL_IMPORT:
+        return module_at(toplevel->import.module)->rules->count;
+    case TOPLEVEL_EXAMPLE:
+        break;
+    }
+    return 0;
 }
 
-bool expr_matches_pattern(Expr *expr, Expr *pattern, IdentList *params, Bindings *bindings) {
-    if (!expr) { return !pattern; }
-    if (!pattern) { return !expr; }
+size_t count_rules(Program *program) {
+    size_t count = 0;
+    for (; program; program = program->rest) { count += count_toplevel_rules(&program->toplevel); }
+    return count;
+}
 
-    switch (pattern->tag) {
-    case EXPR_ZERO:
-        return expr->tag == EXPR_ZERO;
-    case EXPR_VAR:
-        Binding *binding;
-        if ((binding = find_binding(pattern->var, bindings))) {
-            return expr_equals(expr, binding->expr);
-        }
-        if (ident_list_contains(pattern->var, params)) {
-            add_binding(bindings, pattern->var, expr);
-            return true;
-        }
-        if (expr->tag == EXPR_VAR) { return !strcmp(expr->var, pattern->var); }
-        break;
-    case EXPR_SEXP:
-        if (expr->tag == EXPR_SEXP) {
-            return expr_list_matches_pattern(expr->sexp, pattern->sexp, params, bindings);
+/* Adds the rules visible in the imported module, its own imports included. A module imported along
+ * several paths brings the same rules every time, those are only added once. */
+bool register_import(Import *import, Rules *rules) {
+    Rules *imported = module_at(import->module)->rules;
+
+    for (size_t i = 0; i < imported->count; ++i) {
+        Rule *rule = &imported->rules[i];
+        Rule *existing = find_rule(rule->name, rules);
+        if (existing && existing->key == rule->key) { continue; }
+        if (existing) {
+            output("** ERROR ** Duplicate name %s, imported from %s.\n", ident_name(rule->name),
+                   import->path);
+            return false;
         }
-        break;
+
+        add_rule(rules, rule->name, rule->params, rule->lhs, rule->rhs, rule->key,
+                 rule->definition);
     }
-    return false;
+    return true;
 }
 
-bool verify_rule_left_sexp(ExprList *expr_list, ExprList *pattern_list, IdentList *params,
-                           Bindings *bindings) {
-    if (!expr_list) { return !pattern_list; }
-    if (!pattern_list) { return !expr_list; }
+uint64_t expr_key(uint64_t key, Expr *expr) { return hash_combine(key, expr ? expr->hash : 0); }
 
-    if (!verify_rule_left(expr_list->head, pattern_list->head, params, bindings)) { return false; }
-    return verify_rule_left_sexp(expr_list->tail, pattern_list->tail, params, bindings);
+/* Marks aren't part of expressions, so they're hashed beside them. */
+uint64_t marks_key(uint64_t key, Marks *marks) {
+    for (size_t i = 0; i < marks->count; ++i) {
+        MarkPath *path = &marks->paths[i];
+        for (size_t j = 0; j < path->length; ++j) { key = hash_combine(key, path->indices[j]); }
+        key = hash_combine(key, path->length);
+    }
+    return hash_combine(key, marks->count);
 }
 
-bool verify_rule_left(Expr *expr, Expr *pattern, IdentList *params, Bindings *bindings) {
-    switch (pattern->tag) {
-    case EXPR_ZERO:
-        return expr->tag == EXPR_ZERO;
-    case EXPR_VAR:
-        if (ident_list_contains(pattern->var, params)) {
-            Binding *existing_binding;
-            if ((existing_binding = find_binding(pattern->var, bindings))) {
-                return expr_equals(expr, existing_binding->expr);
-            }
+uint64_t ident_list_key(uint64_t key, IdentList *idents) {
+    for (; idents; idents = idents->tail) { key = hash_combine(key, ident_hash(idents->head)); }
+    return hash_combine(key, 0);
+}
 
-            add_binding(bindings, pattern->var, expr);
-            return true;
-        }
-        if (expr->tag != EXPR_VAR) { return false; }
-        if (strcmp(expr->var, pattern->var)) { return false; }
-        return true;
-    case EXPR_SEXP:
-        if (expr->tag != EXPR_SEXP) { return false; }
-        return verify_rule_left_sexp(expr->sexp, pattern->sexp, params, bindings);
+/* Everything `simp` may rewrite with: the defines visible in `rules`. */
+uint64_t definitions_key(Rules *rules) {
+    uint64_t key = 0;
+    for (size_t i = 0; i < rules->count; ++i) {
+        if (rules->rules[i].definition) { key = hash_combine(key, rules->rules[i].key); }
     }
-    return false;
+    return hash_combine(key, 1);
 }
 
-bool verify_rule_right_sexp(ExprList *expr_list, Expr *marked, Expr *replace, ExprList *target_list,
-                            IdentList *params, Bindings *bindings) {
-    if (!expr_list) { return !target_list; }
-    if (!target_list) { return !expr_list; }
+uint64_t direct_key(uint64_t key, Direct *direct, Rules *rules) {
+    key = expr_key(key, direct->start);
+    key = marks_key(key, &direct->start_marks);
+    uint64_t definitions = 0;
+
+    for (Transform *transform = direct->transform; transform; transform = transform->next) {
+        key = hash_combine(key, transform->tag + 1);
+        key = expr_key(key, transform->target);
+        key = marks_key(key, &transform->target_marks);
+        if (transform->tag == TRANSFORM_NAMED) {
+            Rule *rule = find_rule(transform->name, rules);
+            key = hash_combine(key, ident_hash(transform->name));
+            key = hash_combine(key, transform->reversed);
+            key = hash_combine(key, rule ? rule->key : 0);
+        }
+        if (transform->tag == TRANSFORM_SIMP) {
+            if (!definitions) { definitions = definitions_key(rules); }
+            key = hash_combine(key, definitions);
+        }
+    }
+    return hash_combine(key, 0);
+}
 
-    if (!verify_rule_right(expr_list->head, marked, replace, target_list->head, params, bindings)) {
-        return false;
+uint64_t proof_key(uint64_t key, Proof *proof, Rules *rules) {
+    key = hash_combine(key, proof->tag);
+    switch (proof->tag) {
+    case PROOF_DIRECT:
+        return direct_key(key, &proof->direct, rules);
+    case PROOF_INDUCTION:
+        key = hash_combine(key, ident_hash(proof->induction.var));
+        key = direct_key(key, &proof->induction.base, rules);
+        return direct_key(key, &proof->induction.step, rules);
     }
-    return verify_rule_right_sexp(expr_list->tail, marked, replace, target_list->tail, params,
-                                  bindings);
+    return key;
 }
 
-bool verify_rule_right(Expr *expr, Expr *marked, Expr *replace, Expr *target, IdentList *params,
-                       Bindings *bindings) {
-    if (expr == marked) { return expr_matches_pattern(target, replace, params, bindings); }
+/* Content hash of a toplevel, identifying it in the verification cache. The key of every rule a
+ * proof cites is part of its key, so it changes whenever anything the proof transitively depends
+ * on changes. `rules` must only show the rules declared before the toplevel. */
+uint64_t toplevel_key(TopLevel *toplevel, Rules *rules) {
+    uint64_t key = hash_combine(0, toplevel->tag);
 
-    switch (expr->tag) {
-    case EXPR_ZERO:
-    case EXPR_VAR:
-        return expr_equals(expr, target);
-    case EXPR_SEXP:
-        if (target->tag != EXPR_SEXP) { return false; }
-        return verify_rule_right_sexp(expr->sexp, marked, replace, target->sexp, params, bindings);
+    switch (toplevel->tag) {
+    case TOPLEVEL_DEFINE:
+        key = hash_combine(key, ident_hash(toplevel->define.name));
+        key = ident_list_key(key, toplevel->define.params);
+        key = expr_key(key, toplevel->define.lhs);
+        key = marks_key(key, &toplevel->define.lhs_marks);
+        key = expr_key(key, toplevel->define.rhs);
+        key = marks_key(key, &toplevel->define.rhs_marks);
+        break;
+    case TOPLEVEL_THEOREM:
+        key = hash_combine(key, ident_hash(toplevel->theorem.name));
+        key = ident_list_key(key, toplevel->theorem.params);
+        key = expr_key(key, toplevel->theorem.lhs);
+        key = marks_key(key, &toplevel->theorem.lhs_marks);
+        key = expr_key(key, toplevel->theorem.rhs);
+        key = marks_key(key, &toplevel->theorem.rhs_marks);
+        key = proof_key(key, &toplevel->theorem.proof, rules);
+        break;
+    case TOPLEVEL_EXAMPLE:
+        key = expr_key(key, toplevel->example.lhs);
+        key = marks_key(key, &toplevel->example.lhs_marks);
+        key = expr_key(key, toplevel->example.rhs);
+        key = marks_key(key, &toplevel->example.rhs_marks);
+        key = proof_key(key, &toplevel->example.proof, rules);
+        break;
+    case TOPLEVEL_IMPORT:
+        /* the keys of the imported rules are part of the keys of the proofs citing them */
+        break;
     }
-
-    return false;
+    return key ? key : 1;
 }
 
-bool verify_transform(Expr *expr, Transform *transform, Expr *rhs, Rules *rules,
-                      InductionRule *induction_rule) {
-    if (!transform) {
-        if (!expr_equals(expr, rhs)) {
-            printf("** ERROR ** Transformed expression is not RHS.\n");
-            return false;
-        }
+/* Checks a toplevel's name and statement and adds its rule, without looking at the proof. */
+bool register_toplevel(TopLevel *toplevel, Rules *rules, uint64_t key) {
+    switch (toplevel->tag) {
+    case TOPLEVEL_DEFINE:
+        return verify_define(&toplevel->define, rules, key);
+    case TOPLEVEL_THEOREM:
+        return register_theorem(&toplevel->theorem, rules, key);
+    case TOPLEVEL_EXAMPLE:
+        register_example(&toplevel->example);
         return true;
+    case TOPLEVEL_IMPORT:
+        return register_import(&toplevel->import, rules);
     }
+    return false;
+}
 
-    switch (transform->tag) {
-    case TRANSFORM_NAMED:
-        Expr *marked = find_marked_expr(expr);
-        if (!marked) { marked = expr; }
+/* Records how long a theorem or example took to verify, for --stats. `position` counts the
+ * toplevels of its file from 1 and names examples. */
+void record_timing(TopLevel *toplevel, size_t module, size_t position, double seconds) {
+    if (!stats_enabled) { return; }
 
-        Rule *rule = find_rule(transform->name, rules);
-        if (!rule) {
-            printf("** ERROR ** There is no rule with name %s.", transform->name);
-            return false;
-        }
+    char example[32];
+    const char *name = example;
+    switch (toplevel->tag) {
+    case TOPLEVEL_DEFINE:
+    case TOPLEVEL_IMPORT:
+        return;
+    case TOPLEVEL_THEOREM:
+        name = ident_name(toplevel->theorem.name);
+        break;
+    case TOPLEVEL_EXAMPLE:
+        snprintf(example, sizeof(example), "example %zu", position);
+        break;
+    }
 
-        size_t params_count = ident_list_count(rule->params);
-        Bindings *bindings = allocate_bindings(params_count);
+    bool imported = module < modules.count && module != main_module;
+    stats_add_timing(imported ? module_at(module)->path : nullptr, name, seconds);
+}
 
-        Expr *rule_lhs = transform->reversed ? rule->rhs : rule->lhs;
-        Expr *rule_rhs = transform->reversed ? rule->lhs : rule->rhs;
+void record_rule_stats(Rules *rules) {
+    if (!stats_enabled || !rules) { return; }
 
-        if (!verify_rule_left(marked, rule_lhs, rule->params, bindings)) {
-            printf("** ERROR ** Expression doesn't match rule.\n");
-            printf("EXPRESSION: ");
-            print_expr(marked);
-            printf("PATTERN: ");
-            print_expr(rule_lhs);
-            debug_bindings(bindings);
-            free(bindings);
-            return false;
-        }
+    for (size_t i = 0; i < rules->count; ++i) {
+        Rule *rule = &rules->rules[i];
+        stats_add_rule(rule->name, rule->key,
+                       atomic_load_explicit(&rule->applications, memory_order_relaxed));
+    }
+}
 
-        Expr *target = transform->target ? transform->target : rhs;
-        if (!verify_rule_right(expr, marked, rule_rhs, target, rule->params, bindings)) {
-            printf("** ERROR ** Transformed expression doesn't match target.\n");
-            printf("EXPRESSION: ");
-            print_expr(expr);
-            printf("PATTERN: ");
-            print_expr(rule_rhs);
-            printf("TARGET: ");
-            print_expr(target);
-            debug_bindings(bindings);
-            free(bindings);
-            return false;
-        }
+/* The reports buffered by a thread, jobs refer to their part of it by offsets. */
+typedef struct {
+    FILE *stream;
+    char *text;
+    size_t size;
+} Report;
 
-        free(bindings);
-        break;
-    case TRANSFORM_INDUCTION:
-        if (!induction_rule) {
-            printf("** ERROR ** Can't apply induction in a direct proof.\n");
-            return false;
-        }
+/* A part of a report. */
+typedef struct {
+    Report *report;
+    size_t begin;
+    size_t end;
+} ReportPart;
 
-        marked = find_marked_expr(expr);
-        if (!marked) { marked = expr; }
+typedef struct {
+    TopLevel *toplevel;
+    size_t module;
+    size_t position; /* in its module, from 1 */
+    Rules rules; /* the rules declared before the toplevel */
+    uint64_t key;
+    ReportPart registration;
+    ReportPart verification;
+    bool verified;
+    bool silent; /* verified without a single diagnostic */
+    double seconds;
+} Job;
 
-        if (!expr_equals(marked, induction_rule->lhs)) {
-            printf("** ERROR ** Expression doesn't match induction rule.\n");
-            print_expr(marked);
-            print_expr(induction_rule->lhs);
-            return false;
-        }
+typedef struct {
+    Job *jobs;
+    const Cache *known;
+    atomic_size_t first_failure;
+    mtx_t lock; /* guards `reports` */
+    Stack reports;
+} Schedule;
+
+static thread_local Report *thread_report;
+
+/* Prints `part` of a closed report, if the job wrote one. */
+void write_report_part(ReportPart *part) {
+    if (!part->report) { return; }
+    fwrite(part->report->text + part->begin, 1, part->end - part->begin, stdout);
+}
 
-        target = transform->target ? transform->target : rhs;
-        if (!verify_rule_right(expr, marked, induction_rule->rhs, target, nullptr, nullptr)) {
-            printf("** ERROR ** Transformed expression doesn't match induction "
-                   "target.\n");
-            print_expr(expr);
-            print_expr(induction_rule->rhs);
-            print_expr(target);
-            return false;
-        }
-        break;
-    case TRANSFORM_TODO:
-        printf("WARN: There is still something TODO.\n");
-        break;
+/* Redirects the output of the calling thread to its report, opening it on the first job, and
+ * starts `part` there. */
+void begin_report_part(Schedule *schedule, ReportPart *part) {
+    if (!thread_report) {
+        /* the stream keeps the addresses of `text` and `size`, so the report must not move */
+        thread_report = calloc(1, sizeof(Report));
+        thread_report->stream = open_memstream(&thread_report->text, &thread_report->size);
+        mtx_lock(&schedule->lock);
+        *(Report **)stack_push(&schedule->reports) = thread_report;
+        mtx_unlock(&schedule->lock);
     }
 
-    if (transform->target) {
-        return verify_transform(transform->target, transform->next, rhs, rules, induction_rule);
-    }
+    set_output(thread_report->stream);
+    *part = (ReportPart){.report = thread_report, .begin = ftell(thread_report->stream)};
+}
 
-    return true;
+void end_report_part(ReportPart *part) {
+    part->end = ftell(part->report->stream);
+    set_output(nullptr);
 }
 
-bool verify_proof_direct(Direct *direct, Expr *lhs, Expr *rhs, Rules *rules,
-                         InductionRule *induction_rule) {
-    Expr *start = direct->start;
-    if (start) {
-        if (!expr_equals(start, lhs)) {
-            printf("** ERROR ** Starting expression does not equal LHS.\n");
-            print_expr(start);
-            print_expr(lhs);
-            return false;
-        }
-    } else {
-        start = lhs;
+void run_job(void *ctx, size_t index) {
+    Schedule *schedule = ctx;
+    Job *job = &schedule->jobs[index];
+
+    /* the report of anything after a failure is never shown */
+    if (index > atomic_load(&schedule->first_failure)) { return; }
+
+    if (cache_contains(schedule->known, job->key)) {
+        job->verified = job->silent = true;
+        return;
     }
 
-    return verify_transform(start, direct->transform, rhs, rules, induction_rule);
+    begin_report_part(schedule, &job->verification);
+    size_t reported = output_count();
+    double start = stats_now();
+    job->verified = verify_toplevel(job->toplevel, &job->rules);
+    job->seconds = stats_now() - start;
+    job->silent = job->verified && output_count() == reported;
+    end_report_part(&job->verification);
+
+    if (!job->verified) {
+        size_t first = atomic_load(&schedule->first_failure);
+        while (index < first &&
+               !atomic_compare_exchange_weak(&schedule->first_failure, &first, index)) {}
+    }
 }
 
-bool verify_proof_induction(Induction *induction, IdentList *params, Expr *lhs, Expr *rhs,
-                            Rules *rules) {
-    if (!ident_list_contains(induction->var, params)) {
-        printf("** ERROR ** Induction over %s not possible.", induction->var);
-        return false;
+void report_module_failure(size_t index) {
+    if (index != main_module) {
+        output("** ERROR ** Imported module %s is not correct.\n", module_at(index)->path);
     }
+}
 
-    InductionRule induction_rule = (InductionRule){
-        .lhs = lhs,
-        .rhs = rhs,
+/* Every proof only needs the statements of the rules it uses, and those are all registered up
+ * front, module by module in dependency order and in declaration order within a module. So the
+ * proofs of all modules are independent of each other and are verified on `threads` threads, each
+ * buffering the reports of its jobs in a single stream. The reports are printed in that same order
+ * up to the first failure, which is exactly the output of a sequential run. */
+bool verify_program_parallel(size_t threads, const Cache *known, Cache *verified_keys) {
+    size_t count = 0;
+    for (size_t i = 0; i < modules.count; ++i) {
+        for (Program *rest = module_at(i)->program; rest; rest = rest->rest) { count++; }
+    }
+
+    Job *jobs = calloc(count, sizeof(Job));
+    size_t registered = 0;
+    bool registration_failed = false;
+    Schedule schedule = {
+        .jobs = jobs,
+        .known = known,
+        .reports = STACK_OF(Report *),
     };
+    mtx_init(&schedule.lock, mtx_plain);
+
+    for (size_t i = 0; i < modules.count && !registration_failed; ++i) {
+        Module *module = module_at(i);
+        module->rules = allocate_rules(count_rules(module->program));
+
+        size_t position = 0;
+        for (Program *program = module->program; program && !registration_failed;
+             program = program->rest) {
+            Job *job = &jobs[registered++];
+            job->toplevel = &program->toplevel;
+            job->module = i;
+            job->position = ++position;
+            job->rules = *module->rules;
+            job->key = toplevel_key(job->toplevel, module->rules);
+
+            begin_report_part(&schedule, &job->registration);
+            registration_failed = !register_toplevel(job->toplevel, module->rules, job->key);
+            end_report_part(&job->registration);
+        }
+    }
 
-    Expr *base_lhs = clone_expr_and_replace(lhs, new_expr_zero(false), induction->var);
-    Expr *base_rhs = clone_expr_and_replace(rhs, new_expr_zero(false), induction->var);
-    if (!verify_proof_direct(&induction->base, base_lhs, base_rhs, rules, nullptr)) {
-        return false;
+    schedule.first_failure = registration_failed ? registered - 1 : registered;
+    pool_run(schedule.first_failure, threads, run_job, free_thread_state, &schedule);
+    thread_report = nullptr;
+
+    /* closing a report makes its text complete */
+    for (size_t i = 0; i < schedule.reports.count; ++i) {
+        fclose((*(Report **)stack_at(&schedule.reports, i))->stream);
+    }
+    for (size_t i = 0; i < registered; ++i) {
+        if (jobs[i].silent) { cache_add(verified_keys, jobs[i].key); }
+        if (jobs[i].seconds) {
+            record_timing(jobs[i].toplevel, jobs[i].module, jobs[i].position, jobs[i].seconds);
+        }
     }
 
-    Expr *step_lhs = clone_expr_and_replace(
-        lhs, new_expr_succ(new_expr_var(strdup(induction->var), false), false), induction->var);
-    Expr *step_rhs = clone_expr_and_replace(
-        rhs, new_expr_succ(new_expr_var(strdup(induction->var), false), false), induction->var);
+    bool verified = true;
+    for (size_t i = 0; i < registered && verified; ++i) {
+        write_report_part(&jobs[i].registration);
+        write_report_part(&jobs[i].verification);
+        verified = jobs[i].verified;
+        if (!verified) { report_module_failure(jobs[i].module); }
+    }
 
-    if (!verify_proof_direct(&induction->step, step_lhs, step_rhs, rules, &induction_rule)) {
-        return false;
+    for (size_t i = 0; i < schedule.reports.count; ++i) {
+        Report *report = *(Report **)stack_at(&schedule.reports, i);
+        free(report->text);
+        free(report);
     }
+    stack_free(&schedule.reports);
+    mtx_destroy(&schedule.lock);
+    free(jobs);
 
-    return true;
+    return verified;
 }
 
-bool verify_proof(Proof *proof, IdentList *params, Expr *lhs, Expr *rhs, Rules *rules) {
-    switch (proof->tag) {
-    case PROOF_DIRECT:
-        return verify_proof_direct(&proof->direct, lhs, rhs, rules, nullptr);
-    case PROOF_INDUCTION:
-        return verify_proof_induction(&proof->induction, params, lhs, rhs, rules);
-    }
-    return false;
+/* Registers and verifies the toplevel at `position` of a module. `rules` must have room for its
+ * rules. */
+bool check_toplevel(TopLevel *toplevel, size_t module, size_t position, Rules *rules,
+                    const Cache *known, Cache *verified_keys) {
+    Rules declared_before = *rules;
+    uint64_t key = toplevel_key(toplevel, rules);
+    if (!register_toplevel(toplevel, rules, key)) { return false; }
+
+    if (!cache_contains(known, key)) {
+        size_t reported = output_count();
+        double start = stats_now();
+        bool verified = verify_toplevel(toplevel, &declared_before);
+        record_timing(toplevel, module, position, stats_now() - start);
+        if (!verified) { return false; }
+        if (output_count() != reported) { return true; }
+    }
+    cache_add(verified_keys, key);
+    return true;
 }
 
-bool verify_define(Define *define, Rules *rules) {
-    if (find_rule(define->name, rules)) {
-        printf("** ERROR ** Duplicate name %s.\n", define->name);
-        return false;
-    }
+/* Registers and verifies a module whose imports are verified already. */
+bool verify_module(size_t index, const Cache *known, Cache *verified_keys) {
+    Module *module = module_at(index);
+    module->rules = allocate_rules(count_rules(module->program));
 
-    if (find_marked_expr(define->lhs)) {
-        printf("WARN: LHS of define %s contains mark: ", define->name);
-        print_expr(define->lhs);
-        unmark_expr(define->lhs);
+    size_t position = 0;
+    for (Program *program = module->program; program; program = program->rest) {
+        if (!check_toplevel(&program->toplevel, index, ++position, module->rules, known,
+                            verified_keys)) {
+            return false;
+        }
     }
-    if (find_marked_expr(define->rhs)) {
-        printf("WARN: RHS of define %s contains mark: ", define->name);
-        print_expr(define->rhs);
-        unmark_expr(define->rhs);
+    return true;
+}
+
+/* Verifies the modules from `first` on, one after the other. */
+bool verify_modules(size_t first, const Cache *known, Cache *verified_keys) {
+    for (size_t i = first; i < modules.count; ++i) {
+        if (!verify_module(i, known, verified_keys)) {
+            report_module_failure(i);
+            return false;
+        }
     }
+    return true;
+}
 
-    add_rule(rules, define->name, define->params, define->lhs, define->rhs);
+/* Verifies all loaded modules. Toplevels whose key is in `known` are taken as verified without
+ * checking their proofs. The keys of all toplevels that verified without diagnostics are added to
+ * `verified_keys`. */
+bool verify_program(size_t threads, const Cache *known, Cache *verified_keys) {
+    if (threads > 1) { return verify_program_parallel(threads, known, verified_keys); }
+    return verify_modules(0, known, verified_keys);
+}
 
-    return true;
+typedef struct {
+    char *path;
+    Rules *rules;
+    const Cache *known;
+    Cache *verified_keys;
+    size_t position; /* of the last toplevel */
+    bool verified;
+} Stream;
+
+/* Loads and verifies an imported module in the middle of streaming the importing file. */
+bool load_streamed_import(Import *import, Stream *stream) {
+    size_t first = modules.count;
+    char *imported = import_path(stream->path, import->path);
+    bool loaded = load_modules(imported, 1, &import->module);
+    free(imported);
+
+    return loaded && verify_modules(first, stream->known, stream->verified_keys);
 }
 
-bool verify_theorem(Theorem *theorem, Rules *rules) {
-    if (find_rule(theorem->name, rules)) {
-        printf("** ERROR ** Duplicate name %s.\n", theorem->name);
+bool check_streamed_toplevel(TopLevel *toplevel, void *ctx) {
+    Stream *stream = ctx;
+
+    if (toplevel->tag == TOPLEVEL_IMPORT && !load_streamed_import(&toplevel->import, stream)) {
+        stream->verified = false;
         return false;
     }
 
-    if (find_marked_expr(theorem->lhs)) {
-        printf("WARN: LHS of theorem %s contains mark: ", theorem->name);
-        print_expr(theorem->lhs);
-        unmark_expr(theorem->lhs);
-    }
-    if (find_marked_expr(theorem->rhs)) {
-        printf("WARN: RHS of theorem %s contains mark: ", theorem->name);
-        print_expr(theorem->rhs);
-        unmark_expr(theorem->rhs);
-    }
+    reserve_rules(stream->rules, count_toplevel_rules(toplevel));
+    stream->verified = check_toplevel(toplevel, SIZE_MAX, ++stream->position, stream->rules,
+                                      stream->known, stream->verified_keys);
+    arena_reset(&proof_arena);
+    return stream->verified;
+}
 
-    if (!verify_proof(&theorem->proof, theorem->params, theorem->lhs, theorem->rhs, rules)) {
+/* Verifies every toplevel of a file right after parsing it, instead of parsing the whole file
+ * first. Only the statements of the rules are kept, so memory doesn't grow with the proofs and
+ * the first error is reported without reading further. Imports are loaded and verified when
+ * they're reached. */
+bool stream_program(char *filename, const Cache *known, Cache *verified_keys) {
+    Stream stream = {
+        .path = canonical_path(filename),
+        .rules = allocate_rules(0),
+        .known = known,
+        .verified_keys = verified_keys,
+        .verified = true,
+    };
+    if (!stream.path) {
+        output("** ERROR ** Can't read file %s.\n", filename);
+        free_rules(stream.rules);
         return false;
     }
 
-    add_rule(rules, theorem->name, theorem->params, theorem->lhs, theorem->rhs);
+    bool parsed = !parse(stream.path, check_streamed_toplevel, &stream);
+    record_rule_stats(stream.rules);
+    free_rules(stream.rules);
+    free(stream.path);
+    return parsed && stream.verified;
+}
 
+/* Parses the count `arg` of a flag, which has to be all decimal digits without a sign. */
+bool parse_count(const char *arg, size_t *count) {
+    if (*arg < '0' || *arg > '9') { return false; }
+
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(arg, &end, 10);
+    if (*end || errno == ERANGE) { return false; }
+    *count = value;
     return true;
 }
 
-bool verify_example(Example *example, Rules *rules) {
-    if (find_marked_expr(example->lhs)) {
-        printf("WARN: LHS of an example contains mark: ");
-        print_expr(example->lhs);
-        unmark_expr(example->lhs);
-    }
-    if (find_marked_expr(example->rhs)) {
-        printf("WARN: RHS of an example contains mark: ");
-        print_expr(example->rhs);
-        unmark_expr(example->rhs);
+int main(int argc, char **argv) {
+    char *filename = nullptr;
+    size_t threads = 1;
+    bool use_cache = true;
+    bool streaming = false;
+    char *trace_path = nullptr;
+    char *emit_path = nullptr;
+    char *extra = nullptr; /* an argument after the filename */
+    int invalid = 0; /* the index of a flag whose count isn't a number */
+
+    for (int i = 1; i < argc && !invalid; ++i) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            if (!parse_count(argv[++i], &threads)) { invalid = i - 1; }
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            use_cache = false;
+        } else if (!strcmp(argv[i], "--stream")) {
+            streaming = true;
+        } else if (!strcmp(argv[i], "--stats")) {
+            stats_enabled = true;
+        } else if (!strcmp(argv[i], "--suggest")) {
+            suggest_enabled = true;
+        } else if (!strcmp(argv[i], "--fill-todo")) {
+            fill_todo_enabled = true;
+        } else if (!strcmp(argv[i], "--fill-depth") && i + 1 < argc) {
+            if (!parse_count(argv[++i], &fill_todo_depth)) { invalid = i - 1; }
+        } else if (!strcmp(argv[i], "--fill-nodes") && i + 1 < argc) {
+            if (!parse_count(argv[++i], &fill_todo_nodes)) { invalid = i - 1; }
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--emit-c") && i + 1 < argc) {
+            emit_path = argv[++i];
+        } else if (!filename) {
+            filename = argv[i];
+        } else {
+            extra = argv[i];
+            break;
+        }
     }
 
-    return verify_proof(&example->proof, nullptr, example->lhs, example->rhs, rules);
-}
-
-size_t count_rules(Program *program) {
-    if (!program) { return 0; }
-    size_t plus = 0;
-    switch (program->toplevel.tag) {
-    case TOPLEVEL_DEFINE:
-    case TOPLEVEL_THEOREM:
-        plus = 1;
-        break;
-    default:
-        break;
+    /* streaming verifies while parsing, in a single thread, and doesn't keep the rules */
+    bool valid = false;
+    if (invalid) {
+        output("** ERROR ** Invalid value %s for %s, expected a number.\n", argv[invalid + 1],
+               argv[invalid]);
+    } else if (streaming && threads > 1) {
+        output("** ERROR ** --stream can't be combined with -j %zu.\n", threads);
+    } else if (streaming && emit_path) {
+        output("** ERROR ** --stream can't be combined with --emit-c.\n");
+    } else if (!threads) {
+        output("** ERROR ** -j needs at least one thread.\n");
+    } else if (extra) {
+        output("** ERROR ** Unexpected argument %s after the filename %s.\n", extra, filename);
+    } else if (!filename) {
+        output("** ERROR ** Please provide a filename.\n");
+    } else {
+        valid = true;
     }
+    if (!valid) {
+        output("usage: peanoforte [-j THREADS | --stream] [--no-cache] [--stats] [--suggest]\n"
+               "                  [--fill-todo [--fill-depth STEPS] [--fill-nodes EXPRS]]\n"
+               "                  [--trace OUT.json] [--emit-c OUT.c] FILE\n");
+        return 1;
+    }
+    fill_todo_threads = threads;
 
-    return plus + count_rules(program->rest);
-}
+    if (trace_path) { trace_start(); }
 
-bool verify_program(Program *program, Rules *rules) {
-    if (!program) { return true; }
+    TRACE_BEGIN("load", filename);
+    bool loaded = streaming || load_modules(filename, threads, &main_module);
+    TRACE_END();
 
-    switch (program->toplevel.tag) {
-    case TOPLEVEL_DEFINE:
-        if (!verify_define(&program->toplevel.define, rules)) { return false; }
-        break;
-    case TOPLEVEL_THEOREM:
-        if (!verify_theorem(&program->toplevel.theorem, rules)) { return false; }
-        break;
-    case TOPLEVEL_EXAMPLE:
-        if (!verify_example(&program->toplevel.example, rules)) { return false; }
-        break;
+    if (!loaded) {
+        trace_flush();
+        trace_free();
+        free_modules();
+        free_ast();
+        free_symbols();
+        return 1;
     }
 
-    return verify_program(program->rest, rules);
-}
+    if (false && !streaming) {
+        output("\n** DEBUG PRINT **\n-------------------\n");
+        print_program(module_at(main_module)->program);
+    }
 
-int main(int argc, char **argv) {
-    if (argc != 2) {
-        printf("** ERROR ** Please provide a filename.\n");
-        return 1;
+    /* the cache lives next to the program, --no-cache only ignores what's in it. A pipe or device
+     * has no place for one beside it. */
+    struct stat st;
+    char *cache_path = nullptr;
+    if (!stat(filename, &st) && S_ISREG(st.st_mode)) {
+        size_t filename_len = strlen(filename);
+        cache_path = malloc(filename_len + sizeof(".cache"));
+        memcpy(cache_path, filename, filename_len);
+        memcpy(cache_path + filename_len, ".cache", sizeof(".cache"));
     }
 
-    Program *program;
-    int parse_error = parse(argv[1], &program);
+    Cache known = {0};
+    Cache verified_keys = {0};
+    if (use_cache && cache_path) { cache_load(&known, cache_path); }
+
+    TRACE_BEGIN("verify", filename);
+    bool verified = streaming ? stream_program(filename, &known, &verified_keys)
+                              : verify_program(threads, &known, &verified_keys);
+    TRACE_END();
+    int status = verified ? 0 : 1;
+    if (!status) { output("correct.\n"); }
 
-    if (false) {
-        printf("\n** DEBUG PRINT **\n-------------------\n");
-        print_program(program);
+    if (!status && emit_path) {
+        FILE *stream = fopen(emit_path, "w");
+        if (stream) {
+            emit_native_rules(module_at(main_module)->rules, stream);
+            fclose(stream);
+        } else {
+            output("** ERROR ** Can't write %s.\n", emit_path);
+            status = 1;
+        }
     }
 
-    if (parse_error) {
-        free_program(program);
-        return parse_error;
+    if (stats_enabled) {
+        stats_collect();
+        for (size_t i = 0; i < modules.count; ++i) { record_rule_stats(module_at(i)->rules); }
+        stats_report();
+        stats_free();
     }
 
-    size_t rule_count = count_rules(program);
-    Rules *rules = allocate_rules(rule_count);
+    if (trace_path) {
+        trace_flush();
+        if (!trace_write(trace_path)) { output("** ERROR ** Can't write trace %s.\n", trace_path); }
+        trace_free();
+    }
 
-    int status = verify_program(program, rules) ? 0 : 1;
-    if (!status) { printf("correct.\n"); }
+    if (cache_path) { cache_save(&verified_keys, cache_path); }
+    cache_free(&known);
+    cache_free(&verified_keys);
+    free(cache_path);
 
-    free_program(program);
-    free(rules);
+    free_modules();
+    free_thread_state();
+    free_ast();
+    free_symbols();
 
     return status;
 }
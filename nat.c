@@ -0,0 +1,91 @@
+#include "nat.h"
+
+#include <string.h>
+
+#define NAT_BASE 1000000000u
+#define NAT_LIMB_DIGITS 9
+
+static Nat *allocate_nat(Arena *arena, size_t len) {
+    Nat *nat = arena_alloc(arena, sizeof(Nat) + len * sizeof(uint32_t));
+    nat->len = len;
+    return nat;
+}
+
+static void normalize(Nat *nat) {
+    while (nat->len && !nat->limbs[nat->len - 1]) { nat->len--; }
+}
+
+Nat *nat_parse(Arena *arena, const char *digits, size_t len) {
+    Nat *nat = allocate_nat(arena, (len + NAT_LIMB_DIGITS - 1) / NAT_LIMB_DIGITS);
+
+    /* limbs are filled from the least significant end, nine digits at a time */
+    size_t end = len;
+    for (size_t i = 0; i < nat->len; ++i) {
+        size_t start = end > NAT_LIMB_DIGITS ? end - NAT_LIMB_DIGITS : 0;
+        uint32_t limb = 0;
+        for (size_t j = start; j < end; ++j) { limb = limb * 10 + (uint32_t)(digits[j] - '0'); }
+        nat->limbs[i] = limb;
+        end = start;
+    }
+
+    normalize(nat);
+    return nat;
+}
+
+Nat *nat_copy(Arena *arena, const Nat *nat) {
+    Nat *copy = allocate_nat(arena, nat->len);
+    memcpy(copy->limbs, nat->limbs, nat->len * sizeof(uint32_t));
+    return copy;
+}
+
+Nat *nat_succ(Arena *arena, const Nat *nat) {
+    Nat *succ = allocate_nat(arena, nat->len + 1);
+    memcpy(succ->limbs, nat->limbs, nat->len * sizeof(uint32_t));
+    succ->limbs[nat->len] = 0;
+
+    for (size_t i = 0; i < succ->len; ++i) {
+        if (++succ->limbs[i] < NAT_BASE) { break; }
+        succ->limbs[i] = 0;
+    }
+
+    normalize(succ);
+    return succ;
+}
+
+/* `nat` must not be zero. */
+Nat *nat_pred(Arena *arena, const Nat *nat) {
+    Nat *pred = nat_copy(arena, nat);
+
+    for (size_t i = 0; i < pred->len; ++i) {
+        if (pred->limbs[i]--) { break; }
+        pred->limbs[i] = NAT_BASE - 1;
+    }
+
+    normalize(pred);
+    return pred;
+}
+
+bool nat_is_zero(const Nat *nat) { return !nat->len; }
+
+bool nat_equals(const Nat *a, const Nat *b) {
+    return a->len == b->len && !memcmp(a->limbs, b->limbs, a->len * sizeof(uint32_t));
+}
+
+uint64_t nat_hash(const Nat *nat) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (size_t i = 0; i < nat->len; ++i) {
+        h ^= nat->limbs[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+void nat_print(FILE *stream, const Nat *nat) {
+    if (!nat->len) {
+        fprintf(stream, "0");
+        return;
+    }
+
+    fprintf(stream, "%u", nat->limbs[nat->len - 1]);
+    for (size_t i = nat->len - 1; i-- > 0;) { fprintf(stream, "%09u", nat->limbs[i]); }
+}
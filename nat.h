@@ -0,0 +1,26 @@
+#ifndef NAT_H
+#define NAT_H
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Arbitrary-precision natural number, stored as little-endian base 10^9 limbs without leading
+ * zero limbs. Zero has no limbs. */
+typedef struct {
+    size_t len;
+    uint32_t limbs[];
+} Nat;
+
+Nat *nat_parse(Arena *arena, const char *digits, size_t len);
+Nat *nat_copy(Arena *arena, const Nat *nat);
+Nat *nat_succ(Arena *arena, const Nat *nat);
+Nat *nat_pred(Arena *arena, const Nat *nat);
+bool nat_is_zero(const Nat *nat);
+bool nat_equals(const Nat *a, const Nat *b);
+uint64_t nat_hash(const Nat *nat);
+void nat_print(FILE *stream, const Nat *nat);
+
+#endif // !NAT_H
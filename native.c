@@ -0,0 +1,136 @@
+#include "native.h"
+#include "stack.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+int compare_native_keys(const void *key, const void *rule) {
+    uint64_t a = *(const uint64_t *)key;
+    uint64_t b = ((const NativeRule *)rule)->key;
+    return (a > b) - (a < b);
+}
+
+NativeMatcher find_native_matcher(uint64_t key, bool rhs) {
+    if (!native_rules_count) { return nullptr; }
+
+    const NativeRule *rule = bsearch(&key, native_rules, native_rules_count, sizeof(NativeRule),
+                                     compare_native_keys);
+    if (!rule) { return nullptr; }
+    return rhs ? rule->rhs : rule->lhs;
+}
+
+typedef struct {
+    size_t descend; /* the index of the MATCH_DESCEND that entered the sexp */
+    size_t next;    /* the index of its element to match next */
+} EmitFrame;
+
+/* Writes the expression the next instruction matches into `head`, and steps past it. */
+void next_head(Stack *frames, char *head, size_t size) {
+    EmitFrame *frame = stack_top(frames);
+    if (!frame) {
+        snprintf(head, size, "expr");
+        return;
+    }
+    snprintf(head, size, "expr_element(s%zu, %zu)", frame->descend, frame->next++);
+}
+
+/* Writes a matcher that runs `code` unrolled: every sexp entered gets a variable named after the
+ * index of its MATCH_DESCEND, its elements are read at constant indices, and constants are read
+ * from the program at the same index. */
+void emit_matcher(MatchOp *code, size_t rule, const char *side, FILE *stream) {
+    if (code->op == MATCH_NATIVE) { code++; }
+
+    fprintf(stream,
+            "static bool match_%zu_%s([[maybe_unused]] const MatchOp *code, Expr *expr,\n"
+            "                         [[maybe_unused]] Expr **bindings) {\n",
+            rule, side);
+
+    Stack frames = STACK_OF(EmitFrame);
+    char head[64];
+    for (size_t k = 0; code[k].op != MATCH_DONE; ++k) {
+        if (code[k].op != MATCH_ASCEND) { next_head(&frames, head, sizeof(head)); }
+
+        switch (code[k].op) {
+        case MATCH_DESCEND:
+            fprintf(stream,
+                    "    Expr *s%zu = expr_as_sexp(%s);\n"
+                    "    if (!s%zu || s%zu->arity != %" PRIu32 ") { return false; }\n",
+                    k, head, k, k, code[k].arg);
+            *(EmitFrame *)stack_push(&frames) = (EmitFrame){.descend = k};
+            break;
+        case MATCH_ASCEND:
+            stack_pop(&frames);
+            break;
+        case MATCH_CONST:
+            fprintf(stream, "    if (%s != code[%zu].expr) { return false; }\n", head, k);
+            break;
+        case MATCH_BIND:
+            fprintf(stream,
+                    "    if (!bindings[%" PRIu32 "]) {\n"
+                    "        bindings[%" PRIu32 "] = %s;\n"
+                    "        thread_stats.bindings++;\n"
+                    "    } else if (%s != bindings[%" PRIu32 "]) {\n"
+                    "        return false;\n"
+                    "    }\n",
+                    code[k].arg, code[k].arg, head, head, code[k].arg);
+            break;
+        case MATCH_COMPARE:
+            fprintf(stream, "    if (%s != bindings[%" PRIu32 "]) { return false; }\n", head,
+                    code[k].arg);
+            break;
+        case MATCH_DONE:
+        case MATCH_NATIVE:
+            break;
+        }
+    }
+    stack_free(&frames);
+
+    fprintf(stream, "    return true;\n}\n\n");
+}
+
+int compare_rule_keys(const void *a, const void *b) {
+    uint64_t key_a = (*(Rule *const *)a)->key;
+    uint64_t key_b = (*(Rule *const *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+void emit_native_rules(Rules *rules, FILE *stream) {
+    fprintf(stream, "/* Generated by peanoforte --emit-c. Build with `make PRELUDE=<this file>`. */\n"
+                    "\n"
+                    "#include \"native.h\"\n"
+                    "#include \"stats.h\"\n"
+                    "\n");
+
+    /* the table is searched by key */
+    Rule **sorted = malloc((rules->count ? rules->count : 1) * sizeof(Rule *));
+    for (size_t i = 0; i < rules->count; ++i) {
+        Rule *rule = &rules->rules[i];
+        sorted[i] = rule;
+
+        fprintf(stream, "/* %s */\n", ident_name(rule->name));
+        emit_matcher(rule->lhs_code, i, "lhs", stream);
+        emit_matcher(rule->rhs_code, i, "rhs", stream);
+    }
+    qsort(sorted, rules->count, sizeof(Rule *), compare_rule_keys);
+
+    if (!rules->count) {
+        fprintf(stream, "const NativeRule *const native_rules = nullptr;\n"
+                        "const size_t native_rules_count = 0;\n");
+        free(sorted);
+        return;
+    }
+
+    fprintf(stream, "static const NativeRule rules[] = {\n");
+    for (size_t i = 0; i < rules->count; ++i) {
+        size_t index = sorted[i] - rules->rules;
+        fprintf(stream,
+                "    {.key = UINT64_C(0x%016" PRIx64 "), .lhs = match_%zu_lhs, .rhs = match_%zu_rhs},"
+                " /* %s */\n",
+                sorted[i]->key, index, index, ident_name(sorted[i]->name));
+    }
+    fprintf(stream, "};\n"
+                    "\n"
+                    "const NativeRule *const native_rules = rules;\n"
+                    "const size_t native_rules_count = sizeof(rules) / sizeof(rules[0]);\n");
+    free(sorted);
+}
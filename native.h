@@ -0,0 +1,27 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "verify.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* A rule compiled ahead of time by --emit-c, identified by its key. Its matchers do what
+ * `match_program` does with the rule's compiled sides, reading the constants from them. */
+typedef struct {
+    uint64_t key;
+    NativeMatcher lhs;
+    NativeMatcher rhs;
+} NativeRule;
+
+/* The rules compiled into this build, sorted by key. The default prelude.c has none, a build with
+ * the output of --emit-c in its place has the rules of that library. */
+extern const NativeRule *const native_rules;
+extern const size_t native_rules_count;
+
+/* The native matcher of a side of the rule with `key`, nullptr if it isn't compiled in. */
+NativeMatcher find_native_matcher(uint64_t key, bool rhs);
+/* Writes the C source of a rule table with native matchers for every rule in `rules`. */
+void emit_native_rules(Rules *rules, FILE *stream);
+
+#endif // !NATIVE_H
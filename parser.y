@@ -1,25 +1,156 @@
+%code top {
+ /* for MAP_ANONYMOUS */
+ #define _DEFAULT_SOURCE
+}
+
 %{
+ #include <fcntl.h>
  #include <stdio.h>
- #include "lexer.h"
+ #include <stdlib.h>
+ #include <string.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
  #include "ast.h"
- void yyerror(const char *msg);
- Program *program_ast;
+ #include "print.h"
+ #include "trace.h"
+ /* The parse stack lives on the heap, deeply nested expressions only need a large enough limit. */
+ #define YYMAXDEPTH 100000000
 %}
 
-%code requires { #include "ast.h" }
-%code provides { int parse(char *filename, Program **ast); }
+%code requires {
+ #include "ast.h"
+
+ #ifndef YY_TYPEDEF_YY_SCANNER_T
+ #define YY_TYPEDEF_YY_SCANNER_T
+ typedef void *yyscan_t;
+ #endif
+
+ /* The marks of an expression while it's parsed: every mark is the list of element indices
+  * leading to it, shared with the marks of the subexpression it came from. */
+ typedef struct _ParsedPath {
+     size_t index;
+     struct _ParsedPath *rest;
+ } ParsedPath;
+
+ typedef struct _ParsedMark {
+     ParsedPath *path;
+     struct _ParsedMark *next;
+ } ParsedMark;
+
+ typedef struct {
+     Expr *expr;
+     ParsedMark *marks; /* in reading order */
+ } ParsedExpr;
+
+ typedef struct _ParsedList {
+     ParsedExpr head;
+     struct _ParsedList *tail;
+ } ParsedList;
+
+ /* Everything a parse needs, so separate files can be parsed on separate threads at once. */
+ typedef struct {
+     ToplevelHandler handler;
+     void *handler_ctx;
+     Arena numerals; /* numerals only live until they're interned */
+     Arena marks;    /* the ParsedMarks and ParsedLists of the current toplevel */
+     ParsedList *free_lists; /* the nodes of the lists of sexps interned already */
+     Stack elements; /* the elements of the sexp being interned */
+ } ParseContext;
+}
+
+%code provides { int parse(char *filename, ToplevelHandler handle_toplevel, void *ctx); }
+
+%code {
+ #include "lexer.h"
+ void yyerror(yyscan_t scanner, ParseContext *context, const char *msg);
+
+ static ParsedExpr parsed_atom(Expr *expr, bool marked, ParseContext *context) {
+     ParsedMark *mark = nullptr;
+     if (marked) {
+         mark = arena_alloc(&context->marks, sizeof(ParsedMark));
+         *mark = (ParsedMark){0};
+     }
+     return (ParsedExpr){.expr = expr, .marks = mark};
+ }
+
+ static ParsedList *parsed_list(ParsedExpr head, ParsedList *tail, ParseContext *context) {
+     ParsedList *list = context->free_lists;
+     if (list) {
+         context->free_lists = list->tail;
+     } else {
+         list = arena_alloc(&context->marks, sizeof(ParsedList));
+     }
+     *list = (ParsedList){.head = head, .tail = tail};
+     return list;
+ }
+
+ /* Interns the sexp of `list` and prefixes the marks of every element with its index. */
+ static ParsedExpr parsed_sexp(ParsedList *list, bool marked, ParseContext *context) {
+     ParsedExpr sexp = parsed_atom(nullptr, marked, context);
+     ParsedMark **end = sexp.marks ? &sexp.marks->next : &sexp.marks;
+
+     context->elements.count = 0;
+     for (size_t index = 0; list; ++index) {
+         *(Expr **)stack_push(&context->elements) = list->head.expr;
+         for (ParsedMark *mark = list->head.marks; mark; mark = mark->next) {
+             ParsedPath *path = arena_alloc(&context->marks, sizeof(ParsedPath));
+             *path = (ParsedPath){.index = index, .rest = mark->path};
+             *end = arena_alloc(&context->marks, sizeof(ParsedMark));
+             **end = (ParsedMark){.path = path};
+             end = &(*end)->next;
+         }
+
+         /* the element is consumed, its node is reused by the next list */
+         ParsedList *done = list;
+         list = list->tail;
+         done->tail = context->free_lists;
+         context->free_lists = done;
+     }
+     sexp.expr = new_expr_sexp(stack_at(&context->elements, 0), context->elements.count);
+     return sexp;
+ }
+
+ /* Copies parsed marks to `arena`, which holds the node they end up in. */
+ static Marks new_marks(ParsedMark *marks, Arena *arena) {
+     Marks copy = {0};
+     for (ParsedMark *mark = marks; mark; mark = mark->next) { copy.count++; }
+     if (!copy.count) { return copy; }
+
+     copy.paths = ast_alloc(arena, copy.count * sizeof(MarkPath));
+     size_t i = 0;
+     for (ParsedMark *mark = marks; mark; mark = mark->next, ++i) {
+         MarkPath *path = &copy.paths[i];
+         *path = (MarkPath){0};
+         for (ParsedPath *step = mark->path; step; step = step->rest) { path->length++; }
+         if (!path->length) { continue; }
+
+         path->indices = ast_alloc(arena, path->length * sizeof(size_t));
+         size_t j = 0;
+         for (ParsedPath *step = mark->path; step; step = step->rest) {
+             path->indices[j++] = step->index;
+         }
+     }
+     return copy;
+ }
+}
+
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {ParseContext *context}
 
 %union {
-   int num;
-   Program *program;
+   Nat *num;
    TopLevel toplevel;
    Define define;
    Theorem theorem;
    Example example;
+   Import import;
+   char *string;
    Ident ident;
    IdentList *ident_list;
-   Expr *expr;
-   ExprList *expr_list;
+   ParsedExpr expr;
+   ParsedList *expr_list;
    Proof proof;
    Direct direct;
    Induction induction;
@@ -30,18 +161,19 @@
 
 %start program
 
-%token KW_DEFINE KW_THEOREM KW_EXAMPLE KW_INDUCTION KW_BASE KW_STEP KW_TODO KW_BY KW_REV
+%token KW_DEFINE KW_THEOREM KW_EXAMPLE KW_INDUCTION KW_BASE KW_STEP KW_TODO KW_BY KW_REV KW_SIMP KW_IMPORT
 %token PAREN_OPEN PAREN_CLOSE BRACKET_OPEN BRACKET_CLOSE
 %token CURLY_OPEN CURLY_CLOSE ANGLE_OPEN ANGLE_CLOSE EQUALS
 
 %token <num> NUMBER
 %token <ident> IDENT
+%token <string> STRING
 
-%type <program> program;
 %type <toplevel> toplevel;
 %type <define> define;
 %type <theorem> theorem;
 %type <example> example;
+%type <import> import;
 %type <ident_list> parameters;
 %type <proof> proof;
 %type <direct> direct;
@@ -52,35 +184,51 @@
 %type <expr_list> expr_list;
 
 %%
+/* Left recursive, so every toplevel is handed out and dropped from the stack right away. */
 program:
-  /* empty */ { $$ = nullptr; }
-| toplevel program { $$ = new_program($1, $2); program_ast = $$; }
+  /* empty */
+| program toplevel {
+    /* the lookahead starts the next toplevel, so it's a keyword and no numeral is pending */
+    arena_reset(&context->numerals);
+    arena_reset(&context->marks);
+    context->free_lists = nullptr;
+    if (!context->handler(&$2, context->handler_ctx)) { YYABORT; }
+}
 ;
 
 toplevel:
   define { $$ = new_toplevel_define($1); }
 | theorem { $$ = new_toplevel_theorem($1); }
 | example { $$ = new_toplevel_example($1); }
+| import { $$ = new_toplevel_import($1); }
 ;
 
 define:
   KW_DEFINE IDENT expr EQUALS expr {
-    $$ = new_define($2, nullptr, $3, $5);
+    $$ = new_define($2, nullptr, $3.expr, new_marks($3.marks, &ast_arena), $5.expr,
+                    new_marks($5.marks, &ast_arena));
 }
 | KW_DEFINE IDENT ANGLE_OPEN parameters ANGLE_CLOSE expr EQUALS expr {
-    $$ = new_define($2, $4, $6, $8);
+    $$ = new_define($2, $4, $6.expr, new_marks($6.marks, &ast_arena), $8.expr,
+                    new_marks($8.marks, &ast_arena));
 }
 ;
 
 theorem:
   KW_THEOREM IDENT expr EQUALS expr proof {
-    $$ = new_theorem($2, nullptr, $3, $5, $6);
+    $$ = new_theorem($2, nullptr, $3.expr, new_marks($3.marks, &ast_arena), $5.expr,
+                     new_marks($5.marks, &ast_arena), $6);
 }
 | KW_THEOREM IDENT ANGLE_OPEN parameters ANGLE_CLOSE expr EQUALS expr proof {
-    $$ = new_theorem($2, $4, $6, $8, $9);
+    $$ = new_theorem($2, $4, $6.expr, new_marks($6.marks, &ast_arena), $8.expr,
+                     new_marks($8.marks, &ast_arena), $9);
 }
 ;
 
+import:
+  KW_IMPORT STRING { $$ = new_import($2); }
+;
+
 parameters:
   /* empty */ { $$ = nullptr; }
 | IDENT parameters { $$ = new_ident_list($1, $2); }
@@ -88,7 +236,8 @@ parameters:
 
 example:
   KW_EXAMPLE expr EQUALS expr proof {
-    $$ = new_example($2, $4, $5);
+    $$ = new_example($2.expr, new_marks($2.marks, &ast_arena), $4.expr,
+                     new_marks($4.marks, &ast_arena), $5);
 }
 ;
 
@@ -99,7 +248,7 @@ proof:
 
 direct:
   CURLY_OPEN maybe_expr transform CURLY_CLOSE {
-    $$ = new_direct($2, $3);
+    $$ = new_direct($2.expr, new_marks($2.marks, &proof_arena), $3);
 }
 ;
 
@@ -112,51 +261,125 @@ induction:
 transform:
   /* empty */ { $$ = nullptr; }
 | KW_BY IDENT maybe_expr transform {
-    $$ = new_transform_named($2, false, $3, $4);
+    $$ = new_transform_named($2, false, $3.expr, new_marks($3.marks, &proof_arena), $4);
 }
 | KW_BY KW_REV IDENT maybe_expr transform {
-    $$ = new_transform_named($3, true, $4, $5);
+    $$ = new_transform_named($3, true, $4.expr, new_marks($4.marks, &proof_arena), $5);
 }
 | KW_BY KW_INDUCTION maybe_expr transform {
-    $$ = new_transform_induction($3, $4);
+    $$ = new_transform_induction($3.expr, new_marks($3.marks, &proof_arena), $4);
+}
+| KW_BY KW_SIMP maybe_expr transform {
+    $$ = new_transform_simp($3.expr, new_marks($3.marks, &proof_arena), $4);
 }
 | KW_TODO maybe_expr transform {
-    $$ = new_transform_todo($2, $3);
+    $$ = new_transform_todo($2.expr, new_marks($2.marks, &proof_arena), $3);
 }
 ;
 
 expr:
-  NUMBER { $$ = new_expr_num($1, false); }
-| BRACKET_OPEN NUMBER BRACKET_CLOSE { $$ = new_expr_num($2, true); }
-| IDENT { $$ = new_expr_var($1, false); }
-| BRACKET_OPEN IDENT BRACKET_CLOSE { $$ = new_expr_var($2, true); }
-| PAREN_OPEN expr_list PAREN_CLOSE { $$ = new_expr_sexp($2, false); }
-| BRACKET_OPEN expr_list BRACKET_CLOSE { $$ = new_expr_sexp($2, true); }
+  NUMBER { $$ = parsed_atom(new_expr_num($1), false, context); }
+| BRACKET_OPEN NUMBER BRACKET_CLOSE { $$ = parsed_atom(new_expr_num($2), true, context); }
+| IDENT { $$ = parsed_atom(new_expr_var($1), false, context); }
+| BRACKET_OPEN IDENT BRACKET_CLOSE { $$ = parsed_atom(new_expr_var($2), true, context); }
+| PAREN_OPEN expr_list PAREN_CLOSE { $$ = parsed_sexp($2, false, context); }
+| BRACKET_OPEN expr_list BRACKET_CLOSE { $$ = parsed_sexp($2, true, context); }
 ;
 
 maybe_expr:
-  /* empty */ { $$ = nullptr; }
+  /* empty */ { $$ = (ParsedExpr){0}; }
 | expr { $$ = $1; }
 ;
 
 expr_list:
-  expr expr { $$ = new_expr_list($1, new_expr_list($2, nullptr)); }
-| expr expr_list { $$ = new_expr_list($1, $2); }
+  expr expr { $$ = parsed_list($1, parsed_list($2, nullptr, context), context); }
+| expr expr_list { $$ = parsed_list($1, $2, context); }
 ;
 %%
 
-int parse(char *filename, Program **ast) {
-    yyin = fopen(filename, "r");
-    if (yyin == NULL){
-        printf("** ERROR ** Can't read file %s.\n", filename);
+/* Reads what's left of `fd` into an anonymous mapping laid out like the one of `map_source`, for
+ * pipes and other files without a size to map. */
+static char *read_source(int fd, size_t *len) {
+    size_t size = 0;
+    size_t capacity = 4096;
+    char *buffer = malloc(capacity);
+    for (ssize_t n; (n = read(fd, buffer + size, capacity - size)) != 0;) {
+        if (n < 0) {
+            free(buffer);
+            return nullptr;
+        }
+        size += n;
+        if (size == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+
+    *len = size + 2;
+    char *source = mmap(nullptr, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (source != MAP_FAILED) { memcpy(source, buffer, size); }
+    free(buffer);
+    return source == MAP_FAILED ? nullptr : source;
+}
+
+/* Maps the file followed by the two NUL bytes flex expects at the end of a buffer it scans in
+ * place. The file is mapped over an anonymous mapping, so those bytes exist even if the file ends
+ * on a page boundary. The mapping is private, flex temporarily writes into it. */
+static char *map_source(char *filename, size_t *len) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) { close(fd); }
+        return nullptr;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        char *source = read_source(fd, len);
+        close(fd);
+        return source;
+    }
+
+    size_t size = st.st_size;
+    *len = size + 2;
+    char *source = mmap(nullptr, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (source != MAP_FAILED && size &&
+        mmap(source, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(source, *len);
+        source = MAP_FAILED;
+    }
+    close(fd);
+
+    return source == MAP_FAILED ? nullptr : source;
+}
+
+int parse(char *filename, ToplevelHandler handle_toplevel, void *ctx) {
+    size_t len;
+    char *source = map_source(filename, &len);
+    if (source == NULL){
+        output("** ERROR ** Can't read file %s.\n", filename);
         return 1;
     }
+    TRACE_BEGIN("parse", filename);
+
+    ParseContext context = {
+        .handler = handle_toplevel,
+        .handler_ctx = ctx,
+        .elements = STACK_OF(Expr *),
+    };
+    yyscan_t scanner;
+    yylex_init_extra(&context, &scanner);
+    yy_scan_buffer(source, len, scanner);
+
+    int success = yyparse(scanner, &context);
 
-    int success = yyparse();
-    *ast = program_ast;
+    yylex_destroy(scanner);
+    arena_free(&context.numerals);
+    arena_free(&context.marks);
+    stack_free(&context.elements);
+    munmap(source, len);
+    TRACE_END();
     return success;
 }
 
-void yyerror(const char *msg) {
-    printf("** PARSE ERROR ** %s\n", msg);
+void yyerror(yyscan_t, ParseContext *, const char *msg) {
+    output("** PARSE ERROR ** %s\n", msg);
 }
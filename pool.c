@@ -0,0 +1,107 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <threads.h>
+
+typedef struct {
+    mtx_t lock;
+    size_t next; /* first job nobody took yet */
+    size_t end;  /* one past the last job nobody took yet */
+} Share;
+
+typedef struct {
+    Share *shares;
+    size_t thread_count;
+    PoolTask task;
+    PoolFinish finish;
+    void *ctx;
+} Pool;
+
+typedef struct {
+    Pool *pool;
+    size_t index;
+} Worker;
+
+static thread_local bool working;
+
+static bool take_first(Share *share, size_t *job) {
+    mtx_lock(&share->lock);
+    bool taken = share->next < share->end;
+    if (taken) { *job = share->next++; }
+    mtx_unlock(&share->lock);
+    return taken;
+}
+
+static bool take_last(Share *share, size_t *job) {
+    mtx_lock(&share->lock);
+    bool taken = share->next < share->end;
+    if (taken) { *job = --share->end; }
+    mtx_unlock(&share->lock);
+    return taken;
+}
+
+static bool steal(Pool *pool, size_t thief, size_t *job) {
+    for (size_t i = 1; i < pool->thread_count; ++i) {
+        if (take_last(&pool->shares[(thief + i) % pool->thread_count], job)) { return true; }
+    }
+    return false;
+}
+
+static int work(void *arg) {
+    Worker *worker = arg;
+    Pool *pool = worker->pool;
+
+    working = true;
+    size_t job;
+    while (take_first(&pool->shares[worker->index], &job) || steal(pool, worker->index, &job)) {
+        pool->task(pool->ctx, job);
+    }
+    working = false;
+
+    if (pool->finish) { pool->finish(); }
+    return 0;
+}
+
+bool pool_working(void) { return working; }
+
+void pool_run(size_t job_count, size_t thread_count, PoolTask task, PoolFinish finish, void *ctx) {
+    if (thread_count > job_count) { thread_count = job_count; }
+    if (thread_count <= 1) {
+        for (size_t job = 0; job < job_count; ++job) { task(ctx, job); }
+        return;
+    }
+
+    Pool pool = {
+        .shares = malloc(thread_count * sizeof(Share)),
+        .thread_count = thread_count,
+        .task = task,
+        .finish = finish,
+        .ctx = ctx,
+    };
+    Worker *workers = malloc(thread_count * sizeof(Worker));
+    thrd_t *threads = malloc(thread_count * sizeof(thrd_t));
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        mtx_init(&pool.shares[i].lock, mtx_plain);
+        pool.shares[i].next = job_count * i / thread_count;
+        pool.shares[i].end = job_count * (i + 1) / thread_count;
+        workers[i] = (Worker){
+            .pool = &pool,
+            .index = i,
+        };
+    }
+
+    /* the calling thread is worker 0. The shares of workers whose thread couldn't be created are
+     * stolen by the others, as stealing goes through every share. */
+    size_t started = 0;
+    for (size_t i = 1; i < thread_count; ++i) {
+        if (thrd_create(&threads[started], work, &workers[i]) == thrd_success) { started++; }
+    }
+    work(&workers[0]);
+    for (size_t i = 0; i < started; ++i) { thrd_join(threads[i], nullptr); }
+
+    for (size_t i = 0; i < thread_count; ++i) { mtx_destroy(&pool.shares[i].lock); }
+    free(threads);
+    free(workers);
+    free(pool.shares);
+}
@@ -0,0 +1,18 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+typedef void (*PoolTask)(void *ctx, size_t job);
+typedef void (*PoolFinish)(void);
+
+/* Runs `task(ctx, job)` for every job < job_count on `thread_count` threads, the calling one
+ * included. Every thread works through its own contiguous share of the jobs in order and then
+ * steals from the back of the others' shares. Each thread calls `finish` (if given) when it runs
+ * out of work, to release its thread-local state. */
+void pool_run(size_t job_count, size_t thread_count, PoolTask task, PoolFinish finish, void *ctx);
+/* Whether the calling thread is running the jobs of a pool on several threads, so a task can run
+ * its own work inline rather than start another pool within. */
+bool pool_working(void);
+
+#endif // !POOL_H
@@ -0,0 +1,6 @@
+#include "native.h"
+
+/* The rules compiled into this build: none. `make PRELUDE=lib.c` builds with the output of
+ * `peanoforte --emit-c lib.c lib.pf` in place of this file instead. */
+const NativeRule *const native_rules = nullptr;
+const size_t native_rules_count = 0;
@@ -1,6 +1,8 @@
 #include "print.h"
 #include "ast.h"
+#include "stack.h"
 
+#include <stdarg.h>
 #include <stdio.h>
 
 /* forward declarations */
@@ -8,83 +10,170 @@ void _print_expr(Expr *expr);
 void print_transform(Transform *transform);
 void print_proof(Proof *proof);
 
-void _print_ident_list(IdentList *idents) {
-    if (!idents) { return; }
-    printf("%s", idents->head);
-    if (idents->tail) { printf(" "); }
-    _print_ident_list(idents->tail);
-}
+static thread_local FILE *stream;
+static thread_local size_t count;
+
+void set_output(FILE *out) { stream = out; }
+
+FILE *output_stream(void) { return stream ? stream : stdout; }
 
-void _print_sexp_inner(ExprList *sexp) {
-    if (!sexp) { return; }
-    _print_expr(sexp->head);
-    if (sexp->tail) { printf(" "); }
-    _print_sexp_inner(sexp->tail);
+void output(const char *format, ...) {
+    va_list args;
+    count++;
+    va_start(args, format);
+    vfprintf(output_stream(), format, args);
+    va_end(args);
 }
 
-void _print_sexp(ExprList *sexp, bool marked) {
-    printf(marked ? "[" : "(");
-    _print_sexp_inner(sexp);
-    printf(marked ? "]" : ")");
+size_t output_count(void) { return count; }
+
+void _print_ident_list(IdentList *idents) {
+    for (; idents; idents = idents->tail) {
+        output("%s", ident_name(idents->head));
+        if (idents->tail) { output(" "); }
+    }
 }
 
-void _print_expr(Expr *expr) {
-    if (!expr) { printf("null expr"); }
+typedef struct {
+    Expr *sexp;
+    size_t next; /* the index of the element to print next */
+    bool marked;
+} PrintFrame;
 
+void _print_atom(Expr *expr, bool marked) {
+    if (marked) { output("["); }
     switch (expr->tag) {
     case EXPR_ZERO:
-        expr->marked ? printf("[0]") : printf("0");
+        output("0");
+        break;
+    case EXPR_NUM:
+        nat_print(output_stream(), expr->num);
         break;
     case EXPR_VAR:
-        expr->marked ? printf("[%s]", expr->var) : printf("%s", expr->var);
+        output("%s", ident_name(expr->var));
         break;
     case EXPR_SEXP:
-        _print_sexp(expr->sexp, expr->marked);
         break;
     }
+    if (marked) { output("]"); }
+}
+
+/* The length of the common prefix of `path` and the path of the element printed next. */
+static size_t common_prefix(MarkPath *path, Stack *frames) {
+    size_t length = 0;
+    while (length < path->length && length < frames->count &&
+           path->indices[length] == ((PrintFrame *)stack_at(frames, length))->next - 1) {
+        length++;
+    }
+    return length;
 }
 
+/* Prints `expr` with brackets around the subexpressions `marks` point at. Marks come in reading
+ * order, so only the next one is compared with the path walked. A numeral with a mark inside it
+ * is printed as the (succ n-1) it was written as. */
+void _print_marked_expr(Expr *expr, Marks *marks) {
+    if (!expr) {
+        output("null expr");
+        return;
+    }
+
+    Stack frames = STACK_OF(PrintFrame);
+    size_t mark = 0;
+    MarkPath *path = marks->count ? &marks->paths[0] : nullptr;
+    size_t matched = 0; /* how much of `path` leads to `expr` */
+
+    for (;;) {
+        size_t depth = frames.count;
+        bool marked = path && matched == depth && path->length == depth;
+        if (marked) {
+            path = ++mark < marks->count ? &marks->paths[mark] : nullptr;
+            matched = path ? common_prefix(path, &frames) : 0;
+        }
+
+        bool mark_inside = path && matched == depth && path->length > depth;
+        Expr *sexp = expr->tag == EXPR_SEXP || mark_inside ? expr_as_sexp(expr) : nullptr;
+        if (sexp) {
+            output(marked ? "[" : "(");
+            *(PrintFrame *)stack_push(&frames) = (PrintFrame){
+                .sexp = sexp,
+                .marked = marked,
+            };
+        } else {
+            _print_atom(expr, marked);
+        }
+
+        PrintFrame *frame;
+        while ((frame = stack_top(&frames)) && frame->next == frame->sexp->arity) {
+            output(frame->marked ? "]" : ")");
+            stack_pop(&frames);
+        }
+        if (!frame) { break; }
+
+        if (frame->next) { output(" "); }
+        size_t index = frame->next++;
+        expr = expr_element(frame->sexp, index);
+
+        depth = frames.count - 1;
+        if (matched > depth) { matched = depth; }
+        if (path && matched == depth && path->length > depth && path->indices[depth] == index) {
+            matched++;
+        }
+    }
+
+    stack_free(&frames);
+}
+
+void _print_expr(Expr *expr) { _print_marked_expr(expr, &(Marks){0}); }
+
 void print_expr(Expr *expr) {
     _print_expr(expr);
-    printf("\n");
+    output("\n");
 }
 
-void print_transform(Transform *transform) {
-    if (!transform) { return; }
-    printf("TRANSFORM");
+void print_marked_expr(Expr *expr, Marks *marks) {
+    _print_marked_expr(expr, marks);
+    output("\n");
+}
 
-    switch (transform->tag) {
-    case TRANSFORM_NAMED:
-        if (transform->reversed) { printf(" (REVERSED)"); }
-        printf(": %s\n", transform->name);
-        break;
-    case TRANSFORM_INDUCTION:
-        printf(": INDUCTION\n");
-        break;
-    case TRANSFORM_TODO:
-        printf(": TODO\n");
-        break;
+void print_transform(Transform *transform) {
+    for (; transform; transform = transform->next) {
+        output("TRANSFORM");
+
+        switch (transform->tag) {
+        case TRANSFORM_NAMED:
+            if (transform->reversed) { output(" (REVERSED)"); }
+            output(": %s\n", ident_name(transform->name));
+            break;
+        case TRANSFORM_INDUCTION:
+            output(": INDUCTION\n");
+            break;
+        case TRANSFORM_TODO:
+            output(": TODO\n");
+            break;
+        case TRANSFORM_SIMP:
+            output(": SIMP\n");
+            break;
+        }
+
+        if (transform->target) { print_marked_expr(transform->target, &transform->target_marks); }
     }
-
-    if (transform->target) { print_expr(transform->target); }
-    print_transform(transform->next);
 }
 
 void print_proof_direct(Direct proof) {
-    printf("START: ");
+    output("START: ");
     if (proof.start) {
-        print_expr(proof.start);
+        print_marked_expr(proof.start, &proof.start_marks);
     } else {
-        printf("IMPLIED\n");
+        output("IMPLIED\n");
     }
     print_transform(proof.transform);
 }
 
 void print_proof_induction(Induction proof) {
-    printf("INDUCTION BY %s\n", proof.var);
-    printf("--- BASE ---:\n");
+    output("INDUCTION BY %s\n", ident_name(proof.var));
+    output("--- BASE ---:\n");
     print_proof_direct(proof.base);
-    printf("--- STEP ---:\n");
+    output("--- STEP ---:\n");
     print_proof_direct(proof.step);
 }
 
@@ -100,36 +189,38 @@ void print_proof(Proof *proof) {
 }
 
 void print_define(Define *define) {
-    printf("DEFINE %s ", define->name);
-    if (define->params) { printf("<"); }
+    output("DEFINE %s ", ident_name(define->name));
+    if (define->params) { output("<"); }
     _print_ident_list(define->params);
-    if (define->params) { printf("> "); }
-    _print_expr(define->lhs);
-    printf(" = ");
-    print_expr(define->rhs);
+    if (define->params) { output("> "); }
+    _print_marked_expr(define->lhs, &define->lhs_marks);
+    output(" = ");
+    print_marked_expr(define->rhs, &define->rhs_marks);
 }
 
 void print_theorem(Theorem *theorem) {
-    printf("THEOREM %s ", theorem->name);
-    if (theorem->params) { printf("<"); }
+    output("THEOREM %s ", ident_name(theorem->name));
+    if (theorem->params) { output("<"); }
     _print_ident_list(theorem->params);
-    if (theorem->params) { printf("> "); }
-    _print_expr(theorem->lhs);
-    printf(" = ");
-    print_expr(theorem->rhs);
+    if (theorem->params) { output("> "); }
+    _print_marked_expr(theorem->lhs, &theorem->lhs_marks);
+    output(" = ");
+    print_marked_expr(theorem->rhs, &theorem->rhs_marks);
     print_proof(&theorem->proof);
 }
 
 void print_example(Example *example) {
-    printf("EXAMPLE ");
-    _print_expr(example->lhs);
-    printf(" = ");
-    print_expr(example->rhs);
+    output("EXAMPLE ");
+    _print_marked_expr(example->lhs, &example->lhs_marks);
+    output(" = ");
+    print_marked_expr(example->rhs, &example->rhs_marks);
     print_proof(&example->proof);
 }
 
+void print_import(Import *import) { output("IMPORT \"%s\"\n", import->path); }
+
 void print_toplevel(TopLevel *toplevel) {
-    if (!toplevel) { printf("null toplevel\n"); }
+    if (!toplevel) { output("null toplevel\n"); }
 
     switch (toplevel->tag) {
     case TOPLEVEL_DEFINE:
@@ -141,14 +232,15 @@ void print_toplevel(TopLevel *toplevel) {
     case TOPLEVEL_EXAMPLE:
         print_example(&toplevel->example);
         break;
+    case TOPLEVEL_IMPORT:
+        print_import(&toplevel->import);
+        break;
     }
 }
 
 void print_program(Program *program) {
-    if (!program) { return; }
-    print_toplevel(&program->toplevel);
-    if (program->rest) {
-        printf("\n");
-        print_program(program->rest);
+    for (; program; program = program->rest) {
+        print_toplevel(&program->toplevel);
+        if (program->rest) { output("\n"); }
     }
 }
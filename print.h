@@ -3,7 +3,19 @@
 
 #include "ast.h"
 
+#include <stdio.h>
+
+/* All diagnostics go through `output`, to the calling thread's output stream. It's stdout unless
+ * the thread redirected it with `set_output`, e.g. to buffer the report of a parallel job. */
+void set_output(FILE *stream);
+FILE *output_stream(void);
+void output(const char *format, ...);
+/* Number of `output` calls made by the calling thread so far, to tell whether a check was silent. */
+size_t output_count(void);
+
 void print_program(Program *program);
 void print_expr(Expr *expr);
+/* Prints `expr` with its marks in brackets. */
+void print_marked_expr(Expr *expr, Marks *marks);
 
 #endif // !PRINT_H
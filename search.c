@@ -0,0 +1,355 @@
+#include "search.h"
+#include "pool.h"
+#include "print.h"
+
+#include <stdlib.h>
+
+bool fill_todo_enabled;
+size_t fill_todo_depth = 6;
+size_t fill_todo_nodes = 100000;
+size_t fill_todo_threads = 1;
+
+/* the parent of the expressions a search starts from */
+#define NO_PARENT SIZE_MAX
+
+/* An expression reached by a search and the step between it and its parent: forward from the
+ * parent to it, backward from it to the parent. */
+typedef struct {
+    Expr *expr;
+    size_t parent;
+    Rule *rule;
+    bool reversed;
+    size_t position;
+    size_t peel; /* how deep numerals were taken apart in counting `position` */
+} SearchNode;
+
+typedef struct {
+    Stack nodes;
+    size_t *visited; /* open-addressing hash table over the expressions, node indices plus one */
+    size_t visited_capacity;
+    size_t frontier; /* the nodes from here on were reached in the last level */
+    size_t depth;
+} SearchSide;
+
+/* A level of one side, every frontier node is a job pushing its neighbors onto its own stack. */
+typedef struct {
+    SearchSide *side;
+    Rules *rules;
+    Expr *hypothesis_from;
+    Expr *hypothesis_to;
+    Stack *neighbors;
+    size_t peel;   /* succs taken off a numeral at most, the steps left in the search */
+    size_t budget; /* of every job, see `charge` */
+} Expansion;
+
+/* A sexp (or the view of a numeral) on the path to a position and the index of the child the
+ * path goes through. */
+typedef struct {
+    Expr *sexp;
+    size_t child;
+    size_t peeled; /* for the view of a numeral, the views directly above it plus one */
+} PathFrame;
+
+static thread_local Stack path_frames = STACK_OF(PathFrame);
+static thread_local Stack elements = STACK_OF(Expr *);
+static thread_local Stack mark_indices = STACK_OF(size_t);
+static thread_local Stack candidates = STACK_OF(Candidate);
+static thread_local bool searching; /* whether the thread started the search, so it isn't done */
+
+/* Returns the subexpression after `expr` in reading order, nullptr after the last one, keeping the
+ * sexps above it on `path_frames`. A numeral is a leaf below `peel` views of numerals. */
+Expr *next_position(Expr *expr, size_t peel) {
+    PathFrame *top = stack_top(&path_frames);
+    size_t peeled = expr->tag == EXPR_NUM && top ? top->peeled : 0;
+    Expr *sexp = peeled < peel ? expr_as_sexp(expr) : nullptr;
+    if (sexp) {
+        *(PathFrame *)stack_push(&path_frames) = (PathFrame){
+            .sexp = sexp,
+            .peeled = expr->tag == EXPR_NUM ? peeled + 1 : 0,
+        };
+        return expr_element(sexp, 0);
+    }
+
+    PathFrame *frame;
+    while ((frame = stack_top(&path_frames)) && frame->child + 1 == frame->sexp->arity) {
+        stack_pop(&path_frames);
+    }
+    return frame ? expr_element(frame->sexp, ++frame->child) : nullptr;
+}
+
+/* Returns the subexpression at `position`, leaving the sexps above it on `path_frames`. */
+Expr *walk_to(Expr *expr, size_t position, size_t peel) {
+    path_frames.count = 0;
+    for (size_t i = 0; i < position; ++i) { expr = next_position(expr, peel); }
+    return expr;
+}
+
+/* Rebuilds the sexps on `path_frames` around `replacement`, leaving them there. */
+Expr *rebuild_path(Expr *replacement) {
+    for (size_t depth = path_frames.count; depth-- > 0;) {
+        PathFrame *frame = stack_at(&path_frames, depth);
+        elements.count = 0;
+        for (size_t i = 0; i < frame->sexp->arity; ++i) {
+            Expr *element = i == frame->child ? replacement : expr_element(frame->sexp, i);
+            *(Expr **)stack_push(&elements) = element;
+        }
+
+        replacement = new_expr_sexp(stack_at(&elements, 0), elements.count);
+    }
+    return replacement;
+}
+
+/* Prints `expr` with a mark at `position`. */
+void print_marked_at(Expr *expr, size_t position, size_t peel) {
+    walk_to(expr, position, peel);
+    mark_indices.count = 0;
+    for (size_t i = 0; i < path_frames.count; ++i) {
+        *(size_t *)stack_push(&mark_indices) = ((PathFrame *)stack_at(&path_frames, i))->child;
+    }
+
+    MarkPath path = {.length = mark_indices.count, .indices = stack_at(&mark_indices, 0)};
+    print_marked_expr(expr, &(Marks){1, &path});
+}
+
+SearchNode *search_node(SearchSide *side, size_t index) { return stack_at(&side->nodes, index); }
+
+size_t *visited_slot(SearchSide *side, Expr *expr) {
+    size_t mask = side->visited_capacity - 1;
+    size_t i = expr->hash & mask;
+    while (side->visited[i] && search_node(side, side->visited[i] - 1)->expr != expr) {
+        i = (i + 1) & mask;
+    }
+    return &side->visited[i];
+}
+
+size_t find_node(SearchSide *side, Expr *expr) {
+    if (!side->visited_capacity) { return NO_PARENT; }
+    size_t slot = *visited_slot(side, expr);
+    return slot ? slot - 1 : NO_PARENT;
+}
+
+/* Adds `node` unless its expression was visited already. */
+bool add_node(SearchSide *side, SearchNode node) {
+    if (2 * (side->nodes.count + 1) > side->visited_capacity) {
+        free(side->visited);
+        side->visited_capacity = side->visited_capacity ? 2 * side->visited_capacity : 1024;
+        side->visited = calloc(side->visited_capacity, sizeof(size_t));
+        for (size_t i = 0; i < side->nodes.count; ++i) {
+            *visited_slot(side, search_node(side, i)->expr) = i + 1;
+        }
+    }
+
+    size_t *slot = visited_slot(side, node.expr);
+    if (*slot) { return false; }
+    *(SearchNode *)stack_push(&side->nodes) = node;
+    *slot = side->nodes.count;
+    return true;
+}
+
+void push_neighbor(Stack *neighbors, Expr *expr, size_t parent, Rule *rule, bool reversed,
+                   size_t position, size_t peel) {
+    *(SearchNode *)stack_push(neighbors) = (SearchNode){
+        .expr = expr,
+        .parent = parent,
+        .rule = rule,
+        .reversed = reversed,
+        .position = position,
+        .peel = peel,
+    };
+}
+
+/* A neighbor costs the expressions rebuilding it takes: the sexps above the position and itself. */
+size_t charge(void) { return path_frames.count + 1; }
+
+/* Pushes everything a single step at any subexpression turns a frontier expression into. */
+void expand_job(void *ctx, size_t job) {
+    Expansion *expansion = ctx;
+    size_t parent = expansion->side->frontier + job;
+    Expr *expr = search_node(expansion->side, parent)->expr;
+    Stack *neighbors = &expansion->neighbors[job];
+
+    /* a numeral n is (succ n-1) here, so a step can rewrite its predecessors too. Only as many
+     * succs are peeled off as the search has steps left, going on down to 0 would take time linear
+     * in n. */
+    size_t spent = 0;
+    size_t position = 0;
+    path_frames.count = 0;
+    for (Expr *sub = expr; sub && spent < expansion->budget;
+         sub = next_position(sub, expansion->peel), ++position) {
+        if (sub == expansion->hypothesis_from) {
+            push_neighbor(neighbors, rebuild_path(expansion->hypothesis_to), parent, nullptr, false,
+                          position, expansion->peel);
+            spent += charge();
+        }
+
+        candidates.count = 0;
+        find_candidates(expansion->rules, sub, &candidates);
+        for (size_t i = 0; i < candidates.count && spent < expansion->budget; ++i) {
+            Candidate *candidate = stack_at(&candidates, i);
+            Expr *rewritten = apply_rule(candidate->rule, candidate->reversed, sub);
+            if (!rewritten || rewritten == sub) { continue; }
+            push_neighbor(neighbors, rebuild_path(rewritten), parent, candidate->rule,
+                          candidate->reversed, position, expansion->peel);
+            spent += charge();
+        }
+    }
+}
+
+/* Ends a thread of an expansion. The thread that started the search is still in the middle of
+ * verifying a step, so it only drops the expansion's scratch, the others release everything. */
+void finish_expansion(void) {
+    if (!searching) {
+        free_thread_state();
+        return;
+    }
+    stack_free(&path_frames);
+    stack_free(&elements);
+    stack_free(&candidates);
+}
+
+/* Pushes the chain through the forward node `from` and the backward node `to`, which have the same
+ * expression. */
+void push_chain(SearchSide *forward, size_t from, SearchSide *backward, size_t to, Stack *chain) {
+    size_t base = chain->count;
+    for (SearchNode *node = search_node(forward, from); node->parent != NO_PARENT;) {
+        SearchNode *parent = search_node(forward, node->parent);
+        *(ChainStep *)stack_push(chain) = (ChainStep){
+            .expr = parent->expr,
+            .position = node->position,
+            .peel = node->peel,
+            .rule = node->rule,
+            .reversed = node->reversed,
+        };
+        node = parent;
+    }
+    for (size_t i = base, j = chain->count; i + 1 < j; ++i, --j) {
+        ChainStep step = *(ChainStep *)stack_at(chain, i);
+        *(ChainStep *)stack_at(chain, i) = *(ChainStep *)stack_at(chain, j - 1);
+        *(ChainStep *)stack_at(chain, j - 1) = step;
+    }
+
+    for (SearchNode *node = search_node(backward, to); node->parent != NO_PARENT;) {
+        *(ChainStep *)stack_push(chain) = (ChainStep){
+            .expr = node->expr,
+            .position = node->position,
+            .peel = node->peel,
+            .rule = node->rule,
+            .reversed = node->rule && !node->reversed,
+        };
+        node = search_node(backward, node->parent);
+    }
+}
+
+bool search_chain(Expr *from, Expr *to, Rules *rules, Expr *hypothesis_lhs, Expr *hypothesis_rhs,
+                  Stack *chain) {
+    if (from == to) { return true; }
+
+    SearchSide sides[2] = {
+        {.nodes = STACK_OF(SearchNode)},
+        {.nodes = STACK_OF(SearchNode)},
+    };
+    add_node(&sides[0], (SearchNode){.expr = from, .parent = NO_PARENT});
+    add_node(&sides[1], (SearchNode){.expr = to, .parent = NO_PARENT});
+
+    bool found = false;
+    while (!found && sides[0].depth + sides[1].depth < fill_todo_depth &&
+           sides[0].nodes.count + sides[1].nodes.count < fill_todo_nodes) {
+        size_t sizes[2] = {
+            sides[0].nodes.count - sides[0].frontier,
+            sides[1].nodes.count - sides[1].frontier,
+        };
+        if (!sizes[0] || !sizes[1]) { break; }
+
+        /* the smaller frontier is the cheaper one to expand */
+        bool backward = sizes[1] < sizes[0];
+        SearchSide *side = &sides[backward];
+        SearchSide *other = &sides[!backward];
+        size_t left = fill_todo_nodes - sides[0].nodes.count - sides[1].nodes.count;
+        Expansion expansion = {
+            .side = side,
+            .rules = rules,
+            .hypothesis_from = backward ? hypothesis_rhs : hypothesis_lhs,
+            .hypothesis_to = backward ? hypothesis_lhs : hypothesis_rhs,
+            .neighbors = malloc(sizes[backward] * sizeof(Stack)),
+            .peel = fill_todo_depth - sides[0].depth - sides[1].depth,
+            /* shared out evenly, so what a job reaches doesn't depend on the threads */
+            .budget = left / sizes[backward] ? left / sizes[backward] : 1,
+        };
+        for (size_t i = 0; i < sizes[backward]; ++i) {
+            expansion.neighbors[i] = (Stack)STACK_OF(SearchNode);
+        }
+        /* inside a verifier's worker the verification is spread over threads already */
+        size_t threads = pool_working() ? 1 : fill_todo_threads;
+        searching = true;
+        pool_run(sizes[backward], threads, expand_job, finish_expansion, &expansion);
+        searching = false;
+
+        /* merged in job order, so the chain found doesn't depend on the threads */
+        size_t end = side->nodes.count;
+        for (size_t i = 0; i < sizes[backward]; ++i) {
+            Stack *neighbors = &expansion.neighbors[i];
+            for (size_t j = 0; j < neighbors->count && !found; ++j) {
+                if (sides[0].nodes.count + sides[1].nodes.count >= fill_todo_nodes) { break; }
+
+                SearchNode *neighbor = stack_at(neighbors, j);
+                if (!add_node(side, *neighbor)) { continue; }
+
+                size_t met = find_node(other, neighbor->expr);
+                if (met == NO_PARENT) { continue; }
+                if (backward) {
+                    push_chain(other, met, side, side->nodes.count - 1, chain);
+                } else {
+                    push_chain(side, side->nodes.count - 1, other, met, chain);
+                }
+                found = true;
+            }
+            stack_free(neighbors);
+        }
+        free(expansion.neighbors);
+
+        side->frontier = end;
+        side->depth++;
+    }
+
+    for (size_t i = 0; i < 2; ++i) {
+        stack_free(&sides[i].nodes);
+        free(sides[i].visited);
+    }
+    return found;
+}
+
+void fill_todo(Expr *from, Expr *to, Rules *rules, Expr *hypothesis_lhs, Expr *hypothesis_rhs) {
+    Stack chain = STACK_OF(ChainStep);
+    if (!search_chain(from, to, rules, hypothesis_lhs, hypothesis_rhs, &chain)) {
+        output("FILL: No chain of at most %zu steps within %zu expressions found.\n",
+               fill_todo_depth, fill_todo_nodes);
+    } else if (!chain.count) {
+        output("FILL: The expression is the target already.\n");
+    } else {
+        output("FILL:\n");
+        for (size_t i = 0; i < chain.count; ++i) {
+            ChainStep *step = stack_at(&chain, i);
+            output("\t");
+            if (step->position) {
+                print_marked_at(step->expr, step->position, step->peel);
+            } else {
+                print_expr(step->expr);
+            }
+            if (step->rule) {
+                output("\tby %s%s\n", step->reversed ? "rev " : "", ident_name(step->rule->name));
+            } else {
+                output("\tby induction\n");
+            }
+        }
+        output("\t");
+        print_expr(to);
+    }
+    stack_free(&chain);
+}
+
+void free_search_state(void) {
+    stack_free(&path_frames);
+    stack_free(&elements);
+    stack_free(&mark_indices);
+    stack_free(&candidates);
+}
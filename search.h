@@ -0,0 +1,39 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "stack.h"
+#include "verify.h"
+
+/* Set by --fill-todo, --fill-depth and --fill-nodes. */
+extern bool fill_todo_enabled;
+extern size_t fill_todo_depth;   /* steps of a chain at most */
+extern size_t fill_todo_nodes;   /* expressions reached by a search at most */
+extern size_t fill_todo_threads; /* threads expanding a frontier, set by -j */
+
+/* A step of a chain: `rule` (or the induction hypothesis if it's nullptr) applied to the
+ * subexpression of `expr` at `position`, counted in preorder over the elements of sexps,
+ * with a numeral n taken as (succ n-1) down to `peel` succs deep. */
+typedef struct {
+    Expr *expr;
+    size_t position;
+    size_t peel;
+    Rule *rule;
+    bool reversed;
+} ChainStep;
+
+/* Bidirectional breadth-first search for a chain of steps from `from` to `to`, with every rule in
+ * `rules` in both directions and the induction hypothesis `hypothesis_lhs` = `hypothesis_rhs` (if
+ * given) from left to right. The side with the smaller frontier is expanded a level at a time,
+ * on `fill_todo_threads` threads, or on the calling one alone if it's a worker of a pool already.
+ * Every expansion gets its share of what's left of `fill_todo_nodes`, and a neighbor is charged
+ * for the expressions rebuilding it takes, so the limit bounds the work and not only the result.
+ * Pushes the steps of the shortest chain found onto `chain` and returns whether there is one
+ * within the limits. */
+bool search_chain(Expr *from, Expr *to, Rules *rules, Expr *hypothesis_lhs, Expr *hypothesis_rhs,
+                  Stack *chain);
+/* Searches a chain for a `todo` step and prints it in the syntax of the source. */
+void fill_todo(Expr *from, Expr *to, Rules *rules, Expr *hypothesis_lhs, Expr *hypothesis_rhs);
+/* Releases the calling thread's search state. */
+void free_search_state(void);
+
+#endif // !SEARCH_H
@@ -0,0 +1,299 @@
+#include "simp.h"
+#include "stack.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* ends a chain of defines */
+#define NO_RULE SIZE_MAX
+
+typedef struct {
+    Ident head;
+    size_t first;
+    size_t last;
+} HeadChain;
+
+typedef struct {
+    Expr *expr;
+    Expr *normal;
+} MemoEntry;
+
+/* The defines of the last rules view, chained by the head symbol of their LHS so rewriting a node
+ * only tries the defines that can match it, and the normal forms computed with them. */
+typedef struct {
+    size_t version;
+    size_t count;       /* rules scanned for defines */
+    size_t defines_end; /* one past the last define, views at least this long see all of them */
+    size_t *next;       /* the next define in the chain of each define */
+    size_t next_capacity;
+    HeadChain *heads;
+    size_t heads_capacity;
+    size_t heads_count;
+    HeadChain generic; /* defines whose LHS can match any head, e.g. a bare parameter */
+    MemoEntry *memo;
+    size_t memo_capacity;
+    size_t memo_count;
+} Simp;
+
+typedef struct {
+    Expr *expr;
+    size_t next; /* the index of the next child to normalize */
+    size_t results_base;
+    size_t rewritten_base; /* expressions rewritten to `expr`, they share its normal form */
+} SimpFrame;
+
+static thread_local Simp simp;
+static thread_local Stack simp_frames = STACK_OF(SimpFrame);
+static thread_local Stack simp_results = STACK_OF(Expr *);
+static thread_local Stack simp_rewritten = STACK_OF(Expr *);
+
+Ident expr_head(Expr *expr) {
+    switch (expr->tag) {
+    case EXPR_ZERO:
+        return IDENT_NONE;
+    case EXPR_NUM:
+        return ident_succ();
+    case EXPR_VAR:
+        return expr->var;
+    case EXPR_SEXP:
+        Expr *head = expr_element(expr, 0);
+        return head->tag == EXPR_VAR ? head->var : IDENT_NONE;
+    }
+    return IDENT_NONE;
+}
+
+/* The head every expression matching the rule's LHS has, or IDENT_NONE if there is none. */
+Ident pattern_head(Rule *rule) {
+    Ident head = expr_head(rule->lhs);
+    return ident_list_contains(head, rule->params) ? IDENT_NONE : head;
+}
+
+HeadChain *find_head_chain(Ident head) {
+    size_t mask = simp.heads_capacity - 1;
+    size_t i = ident_hash(head) & mask;
+    while (simp.heads[i].head && simp.heads[i].head != head) { i = (i + 1) & mask; }
+    return &simp.heads[i];
+}
+
+void grow_heads(void) {
+    HeadChain *heads = simp.heads;
+    size_t capacity = simp.heads_capacity;
+
+    simp.heads_capacity = capacity ? 2 * capacity : 64;
+    simp.heads = calloc(simp.heads_capacity, sizeof(HeadChain));
+    for (size_t i = 0; i < capacity; ++i) {
+        if (heads[i].head) { *find_head_chain(heads[i].head) = heads[i]; }
+    }
+    free(heads);
+}
+
+void index_define(Rules *rules, size_t index) {
+    Rule *rule = &rules->rules[index];
+    Ident head = pattern_head(rule);
+
+    HeadChain *chain = &simp.generic;
+    if (head) {
+        if (2 * (simp.heads_count + 1) > simp.heads_capacity) { grow_heads(); }
+        chain = find_head_chain(head);
+        if (!chain->head) {
+            *chain = (HeadChain){.head = head, .first = NO_RULE, .last = NO_RULE};
+            simp.heads_count++;
+        }
+    }
+
+    if (chain->last == NO_RULE) {
+        chain->first = index;
+    } else {
+        simp.next[chain->last] = index;
+    }
+    chain->last = index;
+    simp.defines_end = index + 1;
+}
+
+void clear_memo(void) {
+    if (simp.memo_count) { memset(simp.memo, 0, simp.memo_capacity * sizeof(MemoEntry)); }
+    simp.memo_count = 0;
+}
+
+/* Brings the index up to date with `rules`. Rules are only appended, so a longer view of the same
+ * table only adds defines, and a shorter one that still sees all indexed defines needs nothing. */
+void prepare_simp(Rules *rules) {
+    if (rules->version != simp.version || rules->count < simp.defines_end) {
+        simp.version = rules->version;
+        simp.count = 0;
+        simp.defines_end = 0;
+        if (simp.heads_count) { memset(simp.heads, 0, simp.heads_capacity * sizeof(HeadChain)); }
+        simp.heads_count = 0;
+        simp.generic = (HeadChain){.first = NO_RULE, .last = NO_RULE};
+        clear_memo();
+    }
+    if (rules->count <= simp.count) { return; }
+
+    if (rules->count > simp.next_capacity) {
+        simp.next_capacity = rules->count;
+        simp.next = realloc(simp.next, simp.next_capacity * sizeof(size_t));
+    }
+
+    size_t defines_end = simp.defines_end;
+    for (size_t i = simp.count; i < rules->count; ++i) {
+        simp.next[i] = NO_RULE;
+        if (rules->rules[i].definition) { index_define(rules, i); }
+    }
+    simp.count = rules->count;
+
+    /* normal forms may not be normal anymore */
+    if (simp.defines_end != defines_end) { clear_memo(); }
+}
+
+size_t memo_slot(Expr *expr) {
+    size_t mask = simp.memo_capacity - 1;
+    size_t i = expr->hash & mask;
+    while (simp.memo[i].expr && simp.memo[i].expr != expr) { i = (i + 1) & mask; }
+    return i;
+}
+
+Expr *memo_find(Expr *expr) {
+    if (!simp.memo_count) { return nullptr; }
+    return simp.memo[memo_slot(expr)].normal;
+}
+
+void memo_add(Expr *expr, Expr *normal) {
+    if (2 * (simp.memo_count + 1) > simp.memo_capacity) {
+        MemoEntry *memo = simp.memo;
+        size_t capacity = simp.memo_capacity;
+
+        simp.memo_capacity = capacity ? 2 * capacity : 1024;
+        simp.memo = calloc(simp.memo_capacity, sizeof(MemoEntry));
+        for (size_t i = 0; i < capacity; ++i) {
+            if (memo[i].expr) { simp.memo[memo_slot(memo[i].expr)] = memo[i]; }
+        }
+        free(memo);
+    }
+
+    MemoEntry *entry = &simp.memo[memo_slot(expr)];
+    if (!entry->expr) { simp.memo_count++; }
+    *entry = (MemoEntry){
+        .expr = expr,
+        .normal = normal,
+    };
+}
+
+/* Rewrites `expr` at its root with the first define that changes it, or returns nullptr. */
+Expr *rewrite_root(Expr *expr, Rules *rules) {
+    HeadChain *chain = nullptr;
+    Ident head = expr_head(expr);
+    if (head && simp.heads_count) { chain = find_head_chain(head); }
+
+    /* the chain of the head and the generic one, merged back into declaration order */
+    size_t specific = chain && chain->head ? chain->first : NO_RULE;
+    size_t generic = simp.generic.first;
+    while (specific != NO_RULE || generic != NO_RULE) {
+        size_t index;
+        if (generic == NO_RULE || (specific != NO_RULE && specific < generic)) {
+            index = specific;
+            specific = simp.next[specific];
+        } else {
+            index = generic;
+            generic = simp.next[generic];
+        }
+
+        Rule *rule = &rules->rules[index];
+        Expr *rewritten = apply_rule(rule, false, expr);
+        if (!rewritten || rewritten == expr) { continue; }
+
+        if (stats_enabled) {
+            atomic_fetch_add_explicit(&rule->applications, 1, memory_order_relaxed);
+        }
+        return rewritten;
+    }
+    return nullptr;
+}
+
+void push_simp_frame(Expr *expr) {
+    *(SimpFrame *)stack_push(&simp_frames) = (SimpFrame){
+        .expr = expr,
+        .results_base = simp_results.count,
+        .rewritten_base = simp_rewritten.count,
+    };
+}
+
+/* Innermost rewriting without recursion: a node is rewritten at its root once its children are
+ * normal, and whatever that yields is normalized in the same frame. */
+Expr *simp_normalize(Expr *expr, Rules *rules) {
+    prepare_simp(rules);
+
+    Expr *normal = memo_find(expr);
+    if (normal) { return normal; }
+
+    size_t frames_base = simp_frames.count;
+    size_t results_base = simp_results.count;
+    size_t rewritten_base = simp_rewritten.count;
+    size_t fuel = SIMP_FUEL;
+    push_simp_frame(expr);
+
+    while (simp_frames.count > frames_base) {
+        SimpFrame *frame = stack_top(&simp_frames);
+
+        if (frame->expr->tag == EXPR_SEXP && frame->next < frame->expr->arity) {
+            Expr *child = expr_element(frame->expr, frame->next++);
+
+            if ((normal = memo_find(child))) {
+                *(Expr **)stack_push(&simp_results) = normal;
+            } else {
+                push_simp_frame(child);
+            }
+            continue;
+        }
+
+        Expr *rebuilt = frame->expr;
+        if (rebuilt->tag == EXPR_SEXP) {
+            size_t base = frame->results_base;
+            rebuilt = new_expr_sexp(stack_at(&simp_results, base), simp_results.count - base);
+            simp_results.count = base;
+        }
+
+        Expr *rewritten = rewrite_root(rebuilt, rules);
+        normal = rewritten ? memo_find(rewritten) : rebuilt;
+        if (rewritten && !normal) {
+            if (!fuel--) {
+                simp_frames.count = frames_base;
+                simp_results.count = results_base;
+                simp_rewritten.count = rewritten_base;
+                return nullptr;
+            }
+
+            Expr *original = frame->expr;
+            *(Expr **)stack_push(&simp_rewritten) = original;
+            if (rebuilt != original) { *(Expr **)stack_push(&simp_rewritten) = rebuilt; }
+
+            frame = stack_top(&simp_frames);
+            frame->expr = rewritten;
+            frame->next = 0;
+            continue;
+        }
+
+        memo_add(frame->expr, normal);
+        memo_add(rebuilt, normal);
+        while (simp_rewritten.count > frame->rewritten_base) {
+            memo_add(*(Expr **)stack_top(&simp_rewritten), normal);
+            stack_pop(&simp_rewritten);
+        }
+        stack_pop(&simp_frames);
+        *(Expr **)stack_push(&simp_results) = normal;
+    }
+
+    normal = *(Expr **)stack_top(&simp_results);
+    stack_pop(&simp_results);
+    return normal;
+}
+
+void free_simp_state(void) {
+    free(simp.next);
+    free(simp.heads);
+    free(simp.memo);
+    simp = (Simp){0};
+    stack_free(&simp_frames);
+    stack_free(&simp_results);
+    stack_free(&simp_rewritten);
+}
@@ -0,0 +1,16 @@
+#ifndef SIMP_H
+#define SIMP_H
+
+#include "verify.h"
+
+/* Rewrites a single normalization may take before the defines are taken to not terminate. */
+#define SIMP_FUEL 1000000
+
+/* Normal form of `expr` with the defines visible in `rules` as left-to-right rewrites, applied
+ * innermost first and, at every node, in declaration order. Marks are ignored. Normal forms are
+ * memoized per thread for as long as the visible defines stay the same. Returns nullptr if the
+ * normalization runs out of fuel. */
+Expr *simp_normalize(Expr *expr, Rules *rules);
+void free_simp_state(void);
+
+#endif // !SIMP_H
@@ -0,0 +1,31 @@
+#include "stack.h"
+
+#include <stdlib.h>
+
+#define STACK_INITIAL_CAPACITY 64
+
+void *stack_push(Stack *stack) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : STACK_INITIAL_CAPACITY;
+        stack->items = realloc(stack->items, stack->capacity * stack->item_size);
+    }
+    return stack->items + stack->count++ * stack->item_size;
+}
+
+void *stack_top(Stack *stack) {
+    if (!stack->count) { return nullptr; }
+    return stack->items + (stack->count - 1) * stack->item_size;
+}
+
+void *stack_at(Stack *stack, size_t index) { return stack->items + index * stack->item_size; }
+
+void stack_pop(Stack *stack) {
+    if (stack->count) { stack->count--; }
+}
+
+void stack_free(Stack *stack) {
+    free(stack->items);
+    stack->items = nullptr;
+    stack->count = 0;
+    stack->capacity = 0;
+}
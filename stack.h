@@ -0,0 +1,23 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stddef.h>
+
+/* Growable stack of fixed-size items, used as the explicit work stack of expression traversals
+ * so their depth isn't bounded by the native stack. Pointers into it are invalidated by a push. */
+typedef struct {
+    unsigned char *items;
+    size_t item_size;
+    size_t count;
+    size_t capacity;
+} Stack;
+
+#define STACK_OF(type) {.item_size = sizeof(type)}
+
+void *stack_push(Stack *stack);
+void *stack_top(Stack *stack);
+void *stack_at(Stack *stack, size_t index);
+void stack_pop(Stack *stack);
+void stack_free(Stack *stack);
+
+#endif // !STACK_H
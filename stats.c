@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include "print.h"
+#include "stack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+/* entries shown in each of the sorted lists */
+#define REPORT_LIMIT 10
+
+typedef struct {
+    char *label;
+    double seconds;
+} Timing;
+
+typedef struct {
+    Ident name;
+    uint64_t key;
+    size_t applications;
+} RuleCount;
+
+thread_local Stats thread_stats;
+bool stats_enabled;
+
+static Stats totals;
+static Stack timings = STACK_OF(Timing);
+static Stack rule_counts = STACK_OF(RuleCount);
+
+static mtx_t lock;
+static once_flag lock_once = ONCE_FLAG_INIT;
+
+static void init_lock(void) { mtx_init(&lock, mtx_plain); }
+
+double stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+void stats_collect(void) {
+    call_once(&lock_once, init_lock);
+    mtx_lock(&lock);
+    totals.steps += thread_stats.steps;
+    totals.match_visits += thread_stats.match_visits;
+    totals.bindings += thread_stats.bindings;
+    totals.clones += thread_stats.clones;
+    mtx_unlock(&lock);
+    thread_stats = (Stats){0};
+}
+
+void stats_add_timing(const char *file, const char *name, double seconds) {
+    size_t len = strlen(name) + (file ? strlen(file) + sizeof(" ()") : 1);
+    char *label = malloc(len);
+    if (file) {
+        snprintf(label, len, "%s (%s)", name, file);
+    } else {
+        memcpy(label, name, len);
+    }
+
+    *(Timing *)stack_push(&timings) = (Timing){
+        .label = label,
+        .seconds = seconds,
+    };
+}
+
+void stats_add_rule(Ident name, uint64_t key, size_t applications) {
+    *(RuleCount *)stack_push(&rule_counts) = (RuleCount){
+        .name = name,
+        .key = key,
+        .applications = applications,
+    };
+}
+
+static int compare_timings(const void *a, const void *b) {
+    double x = ((const Timing *)a)->seconds;
+    double y = ((const Timing *)b)->seconds;
+    return (x < y) - (x > y);
+}
+
+static int compare_rules(const void *a, const void *b) {
+    const RuleCount *x = a;
+    const RuleCount *y = b;
+    if (x->name != y->name) { return (x->name > y->name) - (x->name < y->name); }
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+static int compare_applications(const void *a, const void *b) {
+    const RuleCount *x = a;
+    const RuleCount *y = b;
+    if (x->applications != y->applications) {
+        return (x->applications < y->applications) - (x->applications > y->applications);
+    }
+    return strcmp(ident_name(x->name), ident_name(y->name));
+}
+
+/* Sums up the counts of the copies of a rule, leaving one entry per rule. */
+static void merge_rule_counts(void) {
+    RuleCount *counts = (RuleCount *)rule_counts.items;
+    if (rule_counts.count) { qsort(counts, rule_counts.count, sizeof(RuleCount), compare_rules); }
+
+    size_t merged = 0;
+    for (size_t i = 0; i < rule_counts.count; ++i) {
+        if (merged && !compare_rules(&counts[merged - 1], &counts[i])) {
+            counts[merged - 1].applications += counts[i].applications;
+        } else {
+            counts[merged++] = counts[i];
+        }
+    }
+    rule_counts.count = merged;
+}
+
+void stats_report(void) {
+    output("\n** STATS **\n");
+    output("steps: %zu\n", totals.steps);
+    output("matcher visits: %zu\n", totals.match_visits);
+    output("bindings: %zu\n", totals.bindings);
+    output("clones: %zu\n", totals.clones);
+
+    Timing *sorted_timings = (Timing *)timings.items;
+    if (timings.count) { qsort(sorted_timings, timings.count, sizeof(Timing), compare_timings); }
+    double total_seconds = 0;
+    for (size_t i = 0; i < timings.count; ++i) { total_seconds += sorted_timings[i].seconds; }
+
+    output("verified toplevels: %zu in %.3f ms\n", timings.count, total_seconds * 1e3);
+    output("slowest toplevels:\n");
+    for (size_t i = 0; i < timings.count && i < REPORT_LIMIT; ++i) {
+        output("%12.3f ms  %s\n", sorted_timings[i].seconds * 1e3, sorted_timings[i].label);
+    }
+
+    merge_rule_counts();
+    RuleCount *counts = (RuleCount *)rule_counts.items;
+    if (rule_counts.count) {
+        qsort(counts, rule_counts.count, sizeof(RuleCount), compare_applications);
+    }
+
+    output("most used rules:\n");
+    for (size_t i = 0; i < rule_counts.count && i < REPORT_LIMIT; ++i) {
+        if (!counts[i].applications) { break; }
+        output("%12zu     %s\n", counts[i].applications, ident_name(counts[i].name));
+    }
+}
+
+void stats_free(void) {
+    for (size_t i = 0; i < timings.count; ++i) { free(((Timing *)stack_at(&timings, i))->label); }
+    stack_free(&timings);
+    stack_free(&rule_counts);
+}
@@ -0,0 +1,34 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "symbol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Work done by the verifier. Every thread counts into its own `thread_stats`, which costs a few
+ * thread-local additions per step, and hands them over with `stats_collect`. */
+typedef struct {
+    size_t steps;        /* transform steps checked */
+    size_t match_visits; /* pattern nodes visited by the matcher */
+    size_t bindings;     /* parameters bound by the matcher */
+    size_t clones;       /* sexp nodes rebuilt by substitution or mark isolation */
+} Stats;
+
+extern thread_local Stats thread_stats;
+/* Set by --stats. Per-rule application counts are only kept when it's on. */
+extern bool stats_enabled;
+
+double stats_now(void);
+/* Adds the calling thread's counters to the totals and clears them. */
+void stats_collect(void);
+/* Records the verification time of a theorem or example. `file` is nullptr for the main file. */
+void stats_add_timing(const char *file, const char *name, double seconds);
+/* Records how often a rule was applied. Copies of a rule made by imports share `name` and `key`
+ * and are counted together. */
+void stats_add_rule(Ident name, uint64_t key, size_t applications);
+/* Prints the totals, the slowest toplevels and the most used rules. */
+void stats_report(void);
+void stats_free(void);
+
+#endif // !STATS_H
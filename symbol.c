@@ -0,0 +1,123 @@
+#include "symbol.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define SYMBOLS_INITIAL_CAPACITY 256
+
+/* Symbols are stored in chunks that never move, chunk k holding 256 << k of them, so looking one up
+ * needs no lock while other threads add more. 25 chunks cover every 32-bit handle. */
+#define CHUNK_BITS 8
+#define CHUNKS_MAX 25
+
+typedef struct {
+    char *name;
+    size_t len;
+    uint64_t hash;
+} Symbol;
+
+static Symbol *chunks[CHUNKS_MAX];
+static size_t symbol_count = 1; /* slot 0 is IDENT_NONE */
+static size_t chunks_count;
+
+static Ident *index_slots;
+static size_t index_capacity;
+
+static mtx_t lock;
+static once_flag lock_once = ONCE_FLAG_INIT;
+
+static Ident succ_ident;
+static once_flag succ_once = ONCE_FLAG_INIT;
+
+static void init_lock(void) { mtx_init(&lock, mtx_plain); }
+
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+static Symbol *symbol_at(Ident ident) {
+    size_t n = (size_t)ident + ((size_t)1 << CHUNK_BITS);
+    size_t chunk = 0;
+    while (n >> (chunk + CHUNK_BITS + 1)) { chunk++; }
+    return &chunks[chunk][n - ((size_t)1 << (chunk + CHUNK_BITS))];
+}
+
+static void index_grow(void) {
+    size_t capacity = index_capacity ? index_capacity * 2 : SYMBOLS_INITIAL_CAPACITY;
+    Ident *slots = calloc(capacity, sizeof(Ident));
+
+    for (Ident ident = 1; ident < symbol_count; ++ident) {
+        size_t i = symbol_at(ident)->hash & (capacity - 1);
+        while (slots[i]) { i = (i + 1) & (capacity - 1); }
+        slots[i] = ident;
+    }
+
+    free(index_slots);
+    index_slots = slots;
+    index_capacity = capacity;
+}
+
+Ident intern_ident(const char *name, size_t len) {
+    uint64_t hash = hash_name(name, len);
+
+    call_once(&lock_once, init_lock);
+    mtx_lock(&lock);
+
+    if (2 * symbol_count > index_capacity) { index_grow(); }
+
+    size_t mask = index_capacity - 1;
+    size_t i = hash & mask;
+    for (Ident ident; (ident = index_slots[i]); i = (i + 1) & mask) {
+        Symbol *symbol = symbol_at(ident);
+        if (symbol->hash == hash && symbol->len == len && !memcmp(symbol->name, name, len)) {
+            mtx_unlock(&lock);
+            return ident;
+        }
+    }
+
+    /* the chunks so far hold the handles below (256 << chunks_count) - 256 */
+    if (symbol_count + ((size_t)1 << CHUNK_BITS) >= (size_t)1 << (chunks_count + CHUNK_BITS)) {
+        chunks[chunks_count] = malloc(((size_t)1 << (chunks_count + CHUNK_BITS)) * sizeof(Symbol));
+        chunks_count++;
+    }
+
+    Ident ident = symbol_count++;
+    *symbol_at(ident) = (Symbol){
+        .name = strndup(name, len),
+        .len = len,
+        .hash = hash,
+    };
+    index_slots[i] = ident;
+    mtx_unlock(&lock);
+    return ident;
+}
+
+const char *ident_name(Ident ident) { return symbol_at(ident)->name; }
+
+uint64_t ident_hash(Ident ident) { return symbol_at(ident)->hash; }
+
+static void intern_succ(void) { succ_ident = intern_ident("succ", 4); }
+
+Ident ident_succ(void) {
+    call_once(&succ_once, intern_succ);
+    return succ_ident;
+}
+
+void free_symbols(void) {
+    for (Ident ident = 1; ident < symbol_count; ++ident) { free(symbol_at(ident)->name); }
+    for (size_t i = 0; i < chunks_count; ++i) {
+        free(chunks[i]);
+        chunks[i] = nullptr;
+    }
+    free(index_slots);
+    symbol_count = 1;
+    chunks_count = 0;
+    index_slots = nullptr;
+    index_capacity = 0;
+}
@@ -0,0 +1,21 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Identifiers are interned into a global symbol table and referred to by a small integer handle,
+ * so comparing two identifiers is an integer comparison. Handle 0 is never a valid symbol.
+ * Interning is thread-safe, and symbols never move once interned, so looking up the name or hash
+ * of a handle needs no lock even while other threads intern. */
+typedef uint32_t Ident;
+
+#define IDENT_NONE ((Ident)0)
+
+Ident intern_ident(const char *name, size_t len);
+const char *ident_name(Ident ident);
+uint64_t ident_hash(Ident ident);
+Ident ident_succ(void);
+void free_symbols(void);
+
+#endif // !SYMBOL_H
@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "stack.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    char detail[48];
+    double timestamp; /* microseconds since `trace_start` */
+    unsigned thread;
+    char phase; /* 'B' begins a span, 'E' ends the innermost one */
+} TraceEvent;
+
+bool trace_enabled;
+
+static double start;
+static atomic_uint next_thread = 1;
+static thread_local unsigned thread;
+static thread_local Stack buffer = STACK_OF(TraceEvent);
+
+static Stack events = STACK_OF(TraceEvent);
+static mtx_t lock;
+static once_flag lock_once = ONCE_FLAG_INIT;
+
+static void init_lock(void) { mtx_init(&lock, mtx_plain); }
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec * 1e6 + (double)time.tv_nsec / 1e3;
+}
+
+void trace_start(void) {
+    start = now();
+    trace_enabled = true;
+}
+
+static TraceEvent *push_event(const char *name, char phase) {
+    if (!thread) { thread = atomic_fetch_add(&next_thread, 1); }
+
+    TraceEvent *event = stack_push(&buffer);
+    event->name = name;
+    event->detail[0] = '\0';
+    event->timestamp = now() - start;
+    event->thread = thread;
+    event->phase = phase;
+    return event;
+}
+
+void trace_begin(const char *name, const char *detail) {
+    TraceEvent *event = push_event(name, 'B');
+    if (!detail) { return; }
+
+    /* a long detail is cut before the character that doesn't fit, so it stays valid UTF-8 */
+    size_t length = strnlen(detail, sizeof(event->detail));
+    if (length == sizeof(event->detail)) {
+        length--;
+        while (length && (detail[length] & 0xc0) == 0x80) { length--; }
+    }
+    memcpy(event->detail, detail, length);
+    event->detail[length] = '\0';
+}
+
+void trace_end(void) { push_event("", 'E'); }
+
+void trace_flush(void) {
+    if (!buffer.count) {
+        stack_free(&buffer);
+        return;
+    }
+
+    call_once(&lock_once, init_lock);
+    mtx_lock(&lock);
+    for (size_t i = 0; i < buffer.count; ++i) {
+        *(TraceEvent *)stack_push(&events) = *(TraceEvent *)stack_at(&buffer, i);
+    }
+    mtx_unlock(&lock);
+    stack_free(&buffer);
+}
+
+static void write_string(FILE *file, const char *string) {
+    fputc('"', file);
+    for (; *string; ++string) {
+        unsigned char c = *string;
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+bool trace_write(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) { return false; }
+
+    fprintf(file, "{\"traceEvents\": [\n");
+    for (size_t i = 0; i < events.count; ++i) {
+        TraceEvent *event = stack_at(&events, i);
+        fprintf(file, "{\"ph\": \"%c\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f", event->phase,
+                event->thread, event->timestamp);
+        if (event->phase == 'B') {
+            fprintf(file, ", \"name\": ");
+            write_string(file, event->name);
+            if (event->detail[0]) {
+                fprintf(file, ", \"args\": {\"detail\": ");
+                write_string(file, event->detail);
+                fputc('}', file);
+            }
+        }
+        fprintf(file, "}%s\n", i + 1 < events.count ? "," : "");
+    }
+    fprintf(file, "], \"displayTimeUnit\": \"ms\"}\n");
+
+    return !fclose(file);
+}
+
+void trace_free(void) { stack_free(&events); }
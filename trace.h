@@ -0,0 +1,28 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Spans of work in the Trace Event Format, to be loaded into a trace viewer (chrome://tracing,
+ * Perfetto). Spans nest per thread. Every thread buffers its own events and hands them over with
+ * `trace_flush` before it ends, `trace_write` saves all of them.
+ * Tracing is off unless --trace turns it on, and the macros then cost a single predictable branch.
+ * `name` has to be a string literal, `detail` is copied (and cut short if it's long). */
+#define TRACE_BEGIN(name, detail)                                                                  \
+    do {                                                                                           \
+        if (trace_enabled) { trace_begin(name, detail); }                                          \
+    } while (0)
+#define TRACE_END()                                                                                \
+    do {                                                                                           \
+        if (trace_enabled) { trace_end(); }                                                        \
+    } while (0)
+
+extern bool trace_enabled;
+
+void trace_start(void);
+void trace_begin(const char *name, const char *detail);
+void trace_end(void);
+void trace_flush(void);
+/* Writes the flushed events to `path`. Returns false if the file can't be written. */
+bool trace_write(const char *path);
+void trace_free(void);
+
+#endif // !TRACE_H
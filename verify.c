@@ -0,0 +1,968 @@
+#include "verify.h"
+#include "native.h"
+#include "print.h"
+#include "search.h"
+#include "simp.h"
+#include "stack.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    Expr *lhs;
+    Expr *rhs;
+} InductionRule;
+
+static atomic_size_t next_rules_version = 1;
+
+static thread_local Stack candidate_values = STACK_OF(size_t);
+
+bool suggest_enabled;
+
+Rules *allocate_rules(size_t len) {
+    size_t index_capacity = 8;
+    while (index_capacity < 2 * len) { index_capacity *= 2; }
+
+    Rules *rules = malloc(sizeof(Rules));
+    rules->count = 0;
+    rules->capacity = len;
+    rules->index_capacity = index_capacity;
+    rules->index = calloc(index_capacity, sizeof(size_t));
+    rules->rules = malloc(len * sizeof(Rule));
+    rules->tree = dtree_new();
+    rules->version = atomic_fetch_add(&next_rules_version, 1);
+    return rules;
+}
+
+void free_rules(Rules *rules) {
+    if (!rules) { return; }
+    for (size_t i = 0; i < rules->count; ++i) {
+        free(rules->rules[i].lhs_slots.slots);
+        free(rules->rules[i].rhs_slots.slots);
+        free(rules->rules[i].lhs_code);
+        free(rules->rules[i].rhs_code);
+    }
+    free(rules->index);
+    free(rules->rules);
+    dtree_free(rules->tree);
+    free(rules);
+}
+
+size_t *find_rule_slot(Ident name, Rules *rules) {
+    size_t mask = rules->index_capacity - 1;
+    size_t i = ident_hash(name) & mask;
+    while (rules->index[i] && rules->rules[rules->index[i] - 1].name != name) {
+        i = (i + 1) & mask;
+    }
+    return &rules->index[i];
+}
+
+/* Makes room for `additional` rules. This moves the rules, so views taken before are invalid. */
+void reserve_rules(Rules *rules, size_t additional) {
+    size_t len = rules->count + additional;
+    if (len <= rules->capacity) { return; }
+
+    size_t capacity = 2 * rules->capacity > len ? 2 * rules->capacity : len;
+    rules->rules = realloc(rules->rules, capacity * sizeof(Rule));
+    rules->capacity = capacity;
+    rules->version = atomic_fetch_add(&next_rules_version, 1);
+
+    if (rules->index_capacity >= 2 * capacity) { return; }
+    while (rules->index_capacity < 2 * capacity) { rules->index_capacity *= 2; }
+    free(rules->index);
+    rules->index = calloc(rules->index_capacity, sizeof(size_t));
+    for (size_t i = 0; i < rules->count; ++i) {
+        *find_rule_slot(rules->rules[i].name, rules) = i + 1;
+    }
+}
+
+/* Resolves the variables of `pattern` to the indices of `params` once, in reading order. */
+ParamSlots compile_pattern(Expr *pattern, IdentList *params) {
+    Stack slots = STACK_OF(uint32_t);
+    Stack pending = STACK_OF(Expr *);
+    *(Expr **)stack_push(&pending) = pattern;
+
+    while (pending.count) {
+        Expr *expr = *(Expr **)stack_top(&pending);
+        stack_pop(&pending);
+
+        if (expr->tag == EXPR_VAR) {
+            uint32_t slot = 0;
+            IdentList *param = params;
+            for (; param && param->head != expr->var; param = param->tail) { slot++; }
+            *(uint32_t *)stack_push(&slots) = param ? slot : NO_SLOT;
+        }
+        if (expr->tag != EXPR_SEXP) { continue; }
+
+        /* the elements are popped in reading order */
+        for (size_t i = expr->arity; i-- > 0;) {
+            *(Expr **)stack_push(&pending) = expr_element(expr, i);
+        }
+    }
+    stack_free(&pending);
+
+    /* rules are kept for the whole run, so the slots are trimmed to their size */
+    ParamSlots compiled = {.count = slots.count};
+    if (slots.count) {
+        compiled.slots = malloc(slots.count * sizeof(uint32_t));
+        memcpy(compiled.slots, slots.items, slots.count * sizeof(uint32_t));
+    }
+    stack_free(&slots);
+    return compiled;
+}
+
+void emit(Stack *code, int op, uint32_t arg, Expr *expr) {
+    *(MatchOp *)stack_push(code) = (MatchOp){
+        .op = op,
+        .arg = arg,
+        .expr = expr,
+    };
+}
+
+/* Compiles `pattern` to the instructions `match_program` runs. Subpatterns that certainly have no
+ * parameter become a single MATCH_CONST, so they're compared in constant time. */
+MatchOp *compile_match(Expr *pattern, IdentList *params, NativeMatcher native) {
+    uint64_t params_vars = 0;
+    for (IdentList *param = params; param; param = param->tail) {
+        params_vars |= var_bit(param->head);
+    }
+
+    bool seen[MAX_RULE_PARAMS] = {0};
+    Stack code = STACK_OF(MatchOp);
+    if (native) { *(MatchOp *)stack_push(&code) = (MatchOp){.op = MATCH_NATIVE, .native = native}; }
+    Stack pending = STACK_OF(Expr *); /* nullptr stands for the end of a sexp */
+    *(Expr **)stack_push(&pending) = pattern;
+
+    while (pending.count) {
+        Expr *expr = *(Expr **)stack_top(&pending);
+        stack_pop(&pending);
+
+        if (!expr) {
+            emit(&code, MATCH_ASCEND, 0, nullptr);
+            continue;
+        }
+
+        uint32_t slot = 0;
+        IdentList *param = params;
+        if (expr->tag == EXPR_VAR) {
+            for (; param && param->head != expr->var; param = param->tail) { slot++; }
+        }
+
+        if (!(expr->vars & params_vars) || (expr->tag != EXPR_SEXP && !param)) {
+            emit(&code, MATCH_CONST, 0, expr);
+        } else if (expr->tag == EXPR_VAR) {
+            emit(&code, seen[slot] ? MATCH_COMPARE : MATCH_BIND, slot, nullptr);
+            seen[slot] = true;
+        } else {
+            emit(&code, MATCH_DESCEND, expr->arity, nullptr);
+
+            /* the elements are popped in reading order, then the end */
+            *(Expr **)stack_push(&pending) = nullptr;
+            for (size_t i = expr->arity; i-- > 0;) {
+                *(Expr **)stack_push(&pending) = expr_element(expr, i);
+            }
+        }
+    }
+    stack_free(&pending);
+
+    emit(&code, MATCH_DONE, 0, nullptr);
+    MatchOp *compiled = malloc(code.count * sizeof(MatchOp));
+    memcpy(compiled, code.items, code.count * sizeof(MatchOp));
+    stack_free(&code);
+    return compiled;
+}
+
+void add_rule(Rules *rules, Ident name, IdentList *params, Expr *lhs, Expr *rhs, uint64_t key,
+              bool definition) {
+    rules->rules[rules->count] = (Rule){
+        .name = name,
+        .params = params,
+        .lhs = lhs,
+        .rhs = rhs,
+        .params_count = ident_list_count(params),
+        .lhs_slots = compile_pattern(lhs, params),
+        .rhs_slots = compile_pattern(rhs, params),
+        .lhs_code = compile_match(lhs, params, find_native_matcher(key, false)),
+        .rhs_code = compile_match(rhs, params, find_native_matcher(key, true)),
+        .key = key,
+        .definition = definition,
+        .applications = 0,
+    };
+    rules->count++;
+    *find_rule_slot(name, rules) = rules->count;
+
+    /* the value of a side is the rule's position, times two, plus one for the RHS */
+    dtree_insert(rules->tree, lhs, params, 2 * (rules->count - 1));
+    dtree_insert(rules->tree, rhs, params, 2 * (rules->count - 1) + 1);
+}
+
+Rule *find_rule(Ident name, Rules *rules) {
+    size_t slot = *find_rule_slot(name, rules);
+    return slot && slot <= rules->count ? &rules->rules[slot - 1] : nullptr;
+}
+
+int compare_values(const void *a, const void *b) {
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+void find_candidates(Rules *rules, Expr *expr, Stack *candidates) {
+    candidate_values.count = 0;
+    dtree_lookup(rules->tree, expr, &candidate_values);
+    if (candidate_values.count) {
+        qsort(candidate_values.items, candidate_values.count, sizeof(size_t), compare_values);
+    }
+
+    for (size_t i = 0; i < candidate_values.count; ++i) {
+        size_t value = *(size_t *)stack_at(&candidate_values, i);
+        if (value / 2 >= rules->count) { break; }
+
+        *(Candidate *)stack_push(candidates) = (Candidate){
+            .rule = &rules->rules[value / 2],
+            .reversed = value % 2,
+        };
+    }
+}
+
+/* Prints the bindings in the order the parameters were bound: matching binds them at their first
+ * variable in reading order, first on the side that was matched and then on the other one. */
+void debug_bindings(Rule *rule, bool reversed, Expr **bindings) {
+    bool printed[MAX_RULE_PARAMS] = {0};
+    ParamSlots *sides[] = {
+        reversed ? &rule->rhs_slots : &rule->lhs_slots,
+        reversed ? &rule->lhs_slots : &rule->rhs_slots,
+    };
+
+    for (size_t side = 0; side < 2; ++side) {
+        for (size_t i = 0; i < sides[side]->count; ++i) {
+            uint32_t slot = sides[side]->slots[i];
+            if (slot == NO_SLOT || !bindings[slot] || printed[slot]) { continue; }
+            printed[slot] = true;
+
+            IdentList *param = rule->params;
+            for (uint32_t j = 0; j < slot; ++j) { param = param->tail; }
+            output("DEBUG: %s -> ", ident_name(param->head));
+            print_expr(bindings[slot]);
+        }
+    }
+}
+
+typedef struct {
+    Expr *sexp;
+    size_t next; /* the index of the next element to visit */
+    size_t results_base;
+} RebuildFrame;
+
+static thread_local Stack rebuild_frames = STACK_OF(RebuildFrame);
+static thread_local Stack rebuild_results = STACK_OF(Expr *);
+
+/* Rebuilds `expr` bottom-up without recursion. `visit` is called on the nodes in reading order and
+ * returns a replacement for the node, or nullptr to rebuild a sexp from its visited children. */
+Expr *rebuild_expr(Expr *expr, RebuildVisitor visit, void *ctx) {
+    Expr *replacement = visit(expr, ctx);
+    if (replacement) { return replacement; }
+
+    size_t frames_base = rebuild_frames.count;
+    *(RebuildFrame *)stack_push(&rebuild_frames) = (RebuildFrame){
+        .sexp = expr,
+        .results_base = rebuild_results.count,
+    };
+
+    while (rebuild_frames.count > frames_base) {
+        RebuildFrame *frame = stack_top(&rebuild_frames);
+
+        if (frame->next < frame->sexp->arity) {
+            Expr *child = expr_element(frame->sexp, frame->next++);
+
+            if ((replacement = visit(child, ctx))) {
+                *(Expr **)stack_push(&rebuild_results) = replacement;
+            } else {
+                *(RebuildFrame *)stack_push(&rebuild_frames) = (RebuildFrame){
+                    .sexp = child,
+                    .results_base = rebuild_results.count,
+                };
+            }
+            continue;
+        }
+
+        size_t base = frame->results_base;
+        Expr *sexp = new_expr_sexp(stack_at(&rebuild_results, base), rebuild_results.count - base);
+        rebuild_results.count = base;
+        stack_pop(&rebuild_frames);
+        thread_stats.clones++;
+        *(Expr **)stack_push(&rebuild_results) = sexp;
+    }
+
+    Expr *rebuilt = *(Expr **)stack_top(&rebuild_results);
+    stack_pop(&rebuild_results);
+    return rebuilt;
+}
+
+static thread_local Stack unit_marks = STACK_OF(MarkPath);
+
+static bool has_prefix(MarkPath *path, MarkPath *prefix) {
+    return path->length >= prefix->length &&
+           !memcmp(path->indices, prefix->indices, prefix->length * sizeof(size_t));
+}
+
+/* Warns about every mark of `expr` but the first one. A later mark is either nested in the first
+ * one or beside it, so it's reported with the subexpression one step off the path they share,
+ * along with the other marks in there. */
+void warn_extra_marks(Expr *expr, Marks *marks) {
+    MarkPath *first = &marks->paths[0];
+
+    for (size_t i = 1; i < marks->count;) {
+        MarkPath *path = &marks->paths[i];
+        size_t shared = 0;
+        while (shared < first->length && path->indices[shared] == first->indices[shared]) {
+            shared++;
+        }
+        MarkPath unit = {.length = shared + 1, .indices = path->indices};
+
+        unit_marks.count = 0;
+        for (; i < marks->count && has_prefix(&marks->paths[i], &unit); ++i) {
+            *(MarkPath *)stack_push(&unit_marks) = (MarkPath){
+                .length = marks->paths[i].length - unit.length,
+                .indices = marks->paths[i].indices + unit.length,
+            };
+        }
+
+        output("** WARN ** More than one subexpression marked: ");
+        Marks unit_marked = {unit_marks.count, stack_at(&unit_marks, 0)};
+        print_marked_expr(expr_at_path(expr, &unit), &unit_marked);
+    }
+}
+
+/* Returns the subexpression of `expr` at its first mark, or `expr` itself if nothing is marked.
+ * Any other mark is warned about and dropped from `marks`. */
+Expr *locate_mark(Expr *expr, Marks *marks) {
+    if (!marks->count) { return expr; }
+    if (marks->count > 1) {
+        warn_extra_marks(expr, marks);
+        marks->count = 1;
+    }
+    return expr_at_path(expr, &marks->paths[0]);
+}
+
+/* Prints the subexpression `locate_mark` found, in brackets if it was marked. */
+void print_located(Expr *marked, Marks *marks) {
+    MarkPath root = {0};
+    print_marked_expr(marked, &(Marks){marks->count ? 1 : 0, &root});
+}
+
+typedef struct {
+    Expr *replacement;
+    Ident param;
+} Substitution;
+
+Expr *substitute_visit(Expr *expr, void *ctx) {
+    Substitution *substitution = ctx;
+
+    /* subexpressions without the variable are shared, not rebuilt */
+    if (!expr_may_contain(expr, substitution->param)) { return expr; }
+
+    switch (expr->tag) {
+    case EXPR_ZERO:
+    case EXPR_NUM:
+        return expr;
+    case EXPR_VAR:
+        return expr->var == substitution->param ? substitution->replacement : expr;
+    case EXPR_SEXP:
+        return nullptr;
+    }
+    return expr;
+}
+
+Expr *clone_expr_and_replace(Expr *orig, Expr *replacement, Ident param) {
+    if (!orig || !replacement) { return orig; }
+
+    Substitution substitution = {
+        .replacement = replacement,
+        .param = param,
+    };
+    return rebuild_expr(orig, substitute_visit, &substitution);
+}
+
+typedef struct {
+    ParamSlots *slots;
+    size_t vars; /* variables visited so far, the index of the next one's slot */
+    Expr **bindings;
+    bool unbound;
+} Instantiation;
+
+Expr *instantiate_visit(Expr *expr, void *ctx) {
+    Instantiation *instantiation = ctx;
+
+    switch (expr->tag) {
+    case EXPR_ZERO:
+    case EXPR_NUM:
+        return expr;
+    case EXPR_VAR:
+        uint32_t slot = instantiation->slots ? instantiation->slots->slots[instantiation->vars++]
+                                             : NO_SLOT;
+        if (slot == NO_SLOT) { return expr; }
+        if (instantiation->bindings[slot]) { return instantiation->bindings[slot]; }
+        instantiation->unbound = true;
+        return expr;
+    case EXPR_SEXP:
+        return nullptr;
+    }
+    return expr;
+}
+
+Expr *instantiate(Expr *pattern, ParamSlots *slots, Expr **bindings) {
+    Instantiation instantiation = {
+        .slots = slots,
+        .bindings = bindings,
+    };
+    Expr *expr = rebuild_expr(pattern, instantiate_visit, &instantiation);
+    return instantiation.unbound ? nullptr : expr;
+}
+
+bool expr_equals(Expr *a, Expr *b) { return a == b; }
+
+typedef struct {
+    const uint32_t *exprs;
+    const uint32_t *patterns;
+    size_t left; /* elements not visited yet */
+} MatchFrame;
+
+static thread_local Stack match_frames = STACK_OF(MatchFrame);
+
+bool var_matches_pattern(Expr *expr, Ident var, uint32_t slot, Expr **bindings) {
+    if (slot == NO_SLOT) { return expr->tag == EXPR_VAR && expr->var == var; }
+    if (bindings[slot]) { return expr_equals(expr, bindings[slot]); }
+
+    bindings[slot] = expr;
+    thread_stats.bindings++;
+    return true;
+}
+
+/* Matches in reading order, with the unvisited siblings of every sexp on an explicit stack. The
+ * variables of the pattern are met in the order of its slots. */
+bool expr_matches_pattern(Expr *expr, Expr *pattern, ParamSlots *slots, Expr **bindings) {
+    if (!expr || !pattern) { return expr == pattern; }
+
+    size_t base = match_frames.count;
+    size_t visits = 0;
+    size_t vars = 0;
+    bool matches = true;
+
+    while (matches) {
+        visits++;
+        switch (pattern->tag) {
+        case EXPR_ZERO:
+            matches = expr->tag == EXPR_ZERO;
+            break;
+        case EXPR_NUM:
+            matches = expr_equals(expr, pattern);
+            break;
+        case EXPR_VAR:
+            uint32_t slot = slots ? slots->slots[vars++] : NO_SLOT;
+            matches = var_matches_pattern(expr, pattern->var, slot, bindings);
+            break;
+        case EXPR_SEXP:
+            Expr *sexp = expr_as_sexp(expr);
+            matches = sexp && sexp->arity == pattern->arity;
+            if (matches) {
+                *(MatchFrame *)stack_push(&match_frames) = (MatchFrame){
+                    .exprs = sexp->elements,
+                    .patterns = pattern->elements,
+                    .left = pattern->arity,
+                };
+            }
+            break;
+        }
+
+        MatchFrame *frame = nullptr;
+        while (matches && match_frames.count > base) {
+            frame = stack_top(&match_frames);
+            if (frame->left) { break; }
+            stack_pop(&match_frames);
+            frame = nullptr;
+        }
+        if (!frame) { break; }
+
+        expr = expr_at(*frame->exprs++);
+        pattern = expr_at(*frame->patterns++);
+        frame->left--;
+    }
+
+    match_frames.count = base;
+    thread_stats.match_visits += visits;
+    return matches;
+}
+
+static thread_local Stack match_cursors = STACK_OF(const uint32_t *);
+
+bool match_program(MatchOp *code, Expr *expr, Expr **bindings) {
+    if (code->op == MATCH_NATIVE) {
+        thread_stats.match_visits++;
+        return code->native(code + 1, expr, bindings);
+    }
+
+    size_t base = match_cursors.count;
+    size_t visits = 0;
+    uint32_t root = expr_handle(expr);
+    const uint32_t *next = &root; /* the handle of the element to match next */
+    bool matches = true;
+
+    for (MatchOp *op = code; matches && op->op != MATCH_DONE; ++op) {
+        visits++;
+        switch (op->op) {
+        case MATCH_DESCEND:
+            Expr *sexp = expr_as_sexp(expr_at(*next));
+            matches = sexp && sexp->arity == op->arg;
+            *(const uint32_t **)stack_push(&match_cursors) = next + 1;
+            next = sexp ? sexp->elements : next;
+            break;
+        case MATCH_ASCEND:
+            next = *(const uint32_t **)stack_top(&match_cursors);
+            stack_pop(&match_cursors);
+            break;
+        case MATCH_CONST:
+            matches = expr_at(*next++) == op->expr;
+            break;
+        case MATCH_BIND:
+            if (!bindings[op->arg]) {
+                bindings[op->arg] = expr_at(*next++);
+                thread_stats.bindings++;
+                break;
+            }
+            [[fallthrough]];
+        case MATCH_COMPARE:
+            matches = expr_equals(expr_at(*next++), bindings[op->arg]);
+            break;
+        case MATCH_DONE:
+        case MATCH_NATIVE:
+            break;
+        }
+    }
+
+    match_cursors.count = base;
+    thread_stats.match_visits += visits;
+    return matches;
+}
+
+Expr *apply_rule(Rule *rule, bool reversed, Expr *expr) {
+    Expr *bindings[MAX_RULE_PARAMS];
+    memset(bindings, 0, rule->params_count * sizeof(Expr *));
+
+    MatchOp *from = reversed ? rule->rhs_code : rule->lhs_code;
+    Expr *to = reversed ? rule->lhs : rule->rhs;
+    ParamSlots *to_slots = reversed ? &rule->lhs_slots : &rule->rhs_slots;
+    if (!match_program(from, expr, bindings)) { return nullptr; }
+    return instantiate(to, to_slots, bindings);
+}
+
+/* A rule's LHS is matched with its compiled program, binding its parameters. */
+bool verify_rule_left(Expr *expr, MatchOp *code, Expr **bindings) {
+    return match_program(code, expr, bindings);
+}
+
+/* Checks that `target` is `expr` with its marked subexpression replaced by an instance of
+ * `replace`. This walks down the path of the mark and compares everything beside it by identity,
+ * so the cost doesn't depend on the size of the untouched subexpressions. */
+bool verify_rule_right(Expr *expr, MarkPath *mark, Expr *replace, Expr *target, MatchOp *code,
+                       Expr **bindings) {
+    for (size_t depth = 0; depth < mark->length; ++depth) {
+        Expr *sexp = expr_as_sexp(expr);
+        Expr *targets = expr_as_sexp(target);
+        size_t index = mark->indices[depth];
+        if (!targets || targets->arity != sexp->arity) { return false; }
+
+        for (size_t i = 0; i < sexp->arity; ++i) {
+            if (i != index && sexp->elements[i] != targets->elements[i]) { return false; }
+        }
+
+        expr = expr_element(sexp, index);
+        target = expr_element(targets, index);
+    }
+
+    /* without a program `replace` has no parameters */
+    return code ? match_program(code, target, bindings) : expr_equals(target, replace);
+}
+
+/* Lists the rules that turn `expr` into `target` at its mark, or failing that the ones that at
+ * least match the marked subexpression. */
+void suggest_rules(Expr *expr, MarkPath *mark, Expr *marked, Expr *target, Rules *rules) {
+    Stack candidates = STACK_OF(Candidate);
+    find_candidates(rules, marked, &candidates);
+
+    size_t suggested = 0;
+    size_t matching = 0;
+    for (size_t i = 0; i < candidates.count; ++i) {
+        Candidate *candidate = stack_at(&candidates, i);
+        Rule *rule = candidate->rule;
+        Expr *to = candidate->reversed ? rule->lhs : rule->rhs;
+        MatchOp *from_code = candidate->reversed ? rule->rhs_code : rule->lhs_code;
+        MatchOp *to_code = candidate->reversed ? rule->lhs_code : rule->rhs_code;
+
+        Expr *bindings[MAX_RULE_PARAMS];
+        memset(bindings, 0, rule->params_count * sizeof(Expr *));
+        if (!verify_rule_left(marked, from_code, bindings)) {
+            candidate->rule = nullptr;
+            continue;
+        }
+        matching++;
+
+        if (!verify_rule_right(expr, mark, to, target, to_code, bindings)) { continue; }
+        output("SUGGESTION: by %s%s\n", candidate->reversed ? "rev " : "", ident_name(rule->name));
+        suggested++;
+    }
+
+    if (!suggested && matching) {
+        output("MATCHING RULES:");
+        for (size_t i = 0; i < candidates.count; ++i) {
+            Candidate *candidate = stack_at(&candidates, i);
+            if (!candidate->rule) { continue; }
+            output(" %s%s", candidate->reversed ? "rev " : "", ident_name(candidate->rule->name));
+        }
+        output("\n");
+    } else if (!suggested) {
+        output("No rule matches the marked expression.\n");
+    }
+
+    stack_free(&candidates);
+}
+
+/* The target of a step, printed with its marks. */
+void print_target(Transform *transform, Expr *rhs) {
+    if (transform->target) {
+        print_marked_expr(transform->target, &transform->target_marks);
+    } else {
+        print_expr(rhs);
+    }
+}
+
+bool verify_step(Expr *expr, Marks marks, Transform *transform, Expr *rhs, Rules *rules,
+                 InductionRule *induction_rule) {
+    MarkPath root = {0};
+    MarkPath *mark = &root;
+
+    switch (transform->tag) {
+    case TRANSFORM_NAMED:
+        Expr *marked = locate_mark(expr, &marks);
+        if (marks.count) { mark = &marks.paths[0]; }
+
+        Expr *target = transform->target ? transform->target : rhs;
+        Rule *rule = find_rule(transform->name, rules);
+        if (!rule) {
+            output("** ERROR ** There is no rule with name %s.", ident_name(transform->name));
+            if (suggest_enabled) {
+                output("\n");
+                suggest_rules(expr, mark, marked, target, rules);
+            }
+            return false;
+        }
+        if (stats_enabled) {
+            atomic_fetch_add_explicit(&rule->applications, 1, memory_order_relaxed);
+        }
+
+        Expr *bindings[MAX_RULE_PARAMS];
+        memset(bindings, 0, rule->params_count * sizeof(Expr *));
+
+        bool reversed = transform->reversed;
+        Expr *rule_lhs = reversed ? rule->rhs : rule->lhs;
+        Expr *rule_rhs = reversed ? rule->lhs : rule->rhs;
+        MatchOp *lhs_code = reversed ? rule->rhs_code : rule->lhs_code;
+        MatchOp *rhs_code = reversed ? rule->lhs_code : rule->rhs_code;
+
+        if (!verify_rule_left(marked, lhs_code, bindings)) {
+            output("** ERROR ** Expression doesn't match rule.\n");
+            output("EXPRESSION: ");
+            print_located(marked, &marks);
+            output("PATTERN: ");
+            print_expr(rule_lhs);
+            debug_bindings(rule, reversed, bindings);
+            if (suggest_enabled) { suggest_rules(expr, mark, marked, target, rules); }
+            return false;
+        }
+
+        if (!verify_rule_right(expr, mark, rule_rhs, target, rhs_code, bindings)) {
+            output("** ERROR ** Transformed expression doesn't match target.\n");
+            output("EXPRESSION: ");
+            print_marked_expr(expr, &marks);
+            output("PATTERN: ");
+            print_expr(rule_rhs);
+            output("TARGET: ");
+            print_target(transform, rhs);
+            debug_bindings(rule, reversed, bindings);
+            if (suggest_enabled) { suggest_rules(expr, mark, marked, target, rules); }
+            return false;
+        }
+        break;
+    case TRANSFORM_INDUCTION:
+        if (!induction_rule) {
+            output("** ERROR ** Can't apply induction in a direct proof.\n");
+            return false;
+        }
+
+        marked = locate_mark(expr, &marks);
+        if (marks.count) { mark = &marks.paths[0]; }
+        if (!expr_equals(marked, induction_rule->lhs)) {
+            output("** ERROR ** Expression doesn't match induction rule.\n");
+            print_located(marked, &marks);
+            print_expr(induction_rule->lhs);
+            return false;
+        }
+
+        target = transform->target ? transform->target : rhs;
+        if (!verify_rule_right(expr, mark, induction_rule->rhs, target, nullptr, nullptr)) {
+            output("** ERROR ** Transformed expression doesn't match induction "
+                   "target.\n");
+            print_marked_expr(expr, &marks);
+            print_expr(induction_rule->rhs);
+            print_target(transform, rhs);
+            return false;
+        }
+        break;
+    case TRANSFORM_SIMP:
+        target = transform->target ? transform->target : rhs;
+        Expr *normal = simp_normalize(expr, rules);
+        Expr *target_normal = normal ? simp_normalize(target, rules) : nullptr;
+        if (!target_normal) {
+            output("** ERROR ** simp didn't reach a normal form within %d rewrites.\n", SIMP_FUEL);
+            return false;
+        }
+
+        if (normal != target_normal) {
+            output("** ERROR ** Expression and target don't simplify to the same normal form.\n");
+            output("EXPRESSION: ");
+            print_expr(normal);
+            output("TARGET: ");
+            print_expr(target_normal);
+            return false;
+        }
+        break;
+    case TRANSFORM_TODO:
+        output("WARN: There is still something TODO.\n");
+        if (!suggest_enabled && !fill_todo_enabled) { break; }
+
+        marked = locate_mark(expr, &marks);
+        if (marks.count) { mark = &marks.paths[0]; }
+        target = transform->target ? transform->target : rhs;
+        if (suggest_enabled) { suggest_rules(expr, mark, marked, target, rules); }
+        if (fill_todo_enabled) {
+            fill_todo(expr, target, rules, induction_rule ? induction_rule->lhs : nullptr,
+                      induction_rule ? induction_rule->rhs : nullptr);
+        }
+        break;
+    }
+
+    return true;
+}
+
+const char *transform_label(Transform *transform) {
+    switch (transform->tag) {
+    case TRANSFORM_NAMED:
+        return ident_name(transform->name);
+    case TRANSFORM_INDUCTION:
+        return "induction";
+    case TRANSFORM_TODO:
+        return "todo";
+    case TRANSFORM_SIMP:
+        return "simp";
+    }
+    return "";
+}
+
+bool verify_transform(Expr *expr, Marks marks, Transform *transform, Expr *rhs, Rules *rules,
+                      InductionRule *induction_rule) {
+    for (; transform; transform = transform->next) {
+        thread_stats.steps++;
+        TRACE_BEGIN("step", transform_label(transform));
+        bool verified = verify_step(expr, marks, transform, rhs, rules, induction_rule);
+        TRACE_END();
+        if (!verified) { return false; }
+
+        /* a step without target goes to the RHS and ends the chain */
+        if (!transform->target) { return true; }
+        expr = transform->target;
+        marks = transform->target_marks;
+    }
+
+    if (!expr_equals(expr, rhs)) {
+        output("** ERROR ** Transformed expression is not RHS.\n");
+        return false;
+    }
+    return true;
+}
+
+bool verify_proof_direct(Direct *direct, Expr *lhs, Expr *rhs, Rules *rules,
+                         InductionRule *induction_rule) {
+    Expr *start = direct->start;
+    Marks marks = direct->start_marks;
+    if (start) {
+        if (!expr_equals(start, lhs)) {
+            output("** ERROR ** Starting expression does not equal LHS.\n");
+            print_expr(start);
+            print_expr(lhs);
+            return false;
+        }
+    } else {
+        /* the marks of the LHS were dropped when it was registered */
+        start = lhs;
+    }
+
+    return verify_transform(start, marks, direct->transform, rhs, rules, induction_rule);
+}
+
+bool verify_proof_induction(Induction *induction, IdentList *params, Expr *lhs, Expr *rhs,
+                            Rules *rules) {
+    if (!ident_list_contains(induction->var, params)) {
+        output("** ERROR ** Induction over %s not possible.", ident_name(induction->var));
+        return false;
+    }
+
+    InductionRule induction_rule = (InductionRule){
+        .lhs = lhs,
+        .rhs = rhs,
+    };
+
+    /* the goals share every subexpression of the theorem without the induction variable */
+    Expr *zero = new_expr_zero();
+    Expr *base_lhs = clone_expr_and_replace(lhs, zero, induction->var);
+    Expr *base_rhs = clone_expr_and_replace(rhs, zero, induction->var);
+    TRACE_BEGIN("induction base", ident_name(induction->var));
+    bool verified = verify_proof_direct(&induction->base, base_lhs, base_rhs, rules, nullptr);
+    TRACE_END();
+    if (!verified) { return false; }
+
+    Expr *succ = new_expr_succ(new_expr_var(induction->var));
+    Expr *step_lhs = clone_expr_and_replace(lhs, succ, induction->var);
+    Expr *step_rhs = clone_expr_and_replace(rhs, succ, induction->var);
+
+    TRACE_BEGIN("induction step", ident_name(induction->var));
+    verified = verify_proof_direct(&induction->step, step_lhs, step_rhs, rules, &induction_rule);
+    TRACE_END();
+    return verified;
+}
+
+bool verify_proof(Proof *proof, IdentList *params, Expr *lhs, Expr *rhs, Rules *rules) {
+    switch (proof->tag) {
+    case PROOF_DIRECT:
+        return verify_proof_direct(&proof->direct, lhs, rhs, rules, nullptr);
+    case PROOF_INDUCTION:
+        return verify_proof_induction(&proof->induction, params, lhs, rhs, rules);
+    }
+    return false;
+}
+
+bool verify_define(Define *define, Rules *rules, uint64_t key) {
+    TRACE_BEGIN("define", ident_name(define->name));
+    if (find_rule(define->name, rules)) {
+        output("** ERROR ** Duplicate name %s.\n", ident_name(define->name));
+        TRACE_END();
+        return false;
+    }
+    if (ident_list_count(define->params) > MAX_RULE_PARAMS) {
+        output("** ERROR ** %s has more than %d parameters.\n", ident_name(define->name),
+               MAX_RULE_PARAMS);
+        TRACE_END();
+        return false;
+    }
+
+    if (define->lhs_marks.count) {
+        output("WARN: LHS of define %s contains mark: ", ident_name(define->name));
+        print_marked_expr(define->lhs, &define->lhs_marks);
+        define->lhs_marks = (Marks){0};
+    }
+    if (define->rhs_marks.count) {
+        output("WARN: RHS of define %s contains mark: ", ident_name(define->name));
+        print_marked_expr(define->rhs, &define->rhs_marks);
+        define->rhs_marks = (Marks){0};
+    }
+
+    add_rule(rules, define->name, define->params, define->lhs, define->rhs, key, true);
+    TRACE_END();
+
+    return true;
+}
+
+bool register_theorem(Theorem *theorem, Rules *rules, uint64_t key) {
+    if (find_rule(theorem->name, rules)) {
+        output("** ERROR ** Duplicate name %s.\n", ident_name(theorem->name));
+        return false;
+    }
+    if (ident_list_count(theorem->params) > MAX_RULE_PARAMS) {
+        output("** ERROR ** %s has more than %d parameters.\n", ident_name(theorem->name),
+               MAX_RULE_PARAMS);
+        return false;
+    }
+
+    if (theorem->lhs_marks.count) {
+        output("WARN: LHS of theorem %s contains mark: ", ident_name(theorem->name));
+        print_marked_expr(theorem->lhs, &theorem->lhs_marks);
+        theorem->lhs_marks = (Marks){0};
+    }
+    if (theorem->rhs_marks.count) {
+        output("WARN: RHS of theorem %s contains mark: ", ident_name(theorem->name));
+        print_marked_expr(theorem->rhs, &theorem->rhs_marks);
+        theorem->rhs_marks = (Marks){0};
+    }
+
+    add_rule(rules, theorem->name, theorem->params, theorem->lhs, theorem->rhs, key, false);
+
+    return true;
+}
+
+bool verify_theorem(Theorem *theorem, Rules *rules) {
+    TRACE_BEGIN("theorem", ident_name(theorem->name));
+    bool verified =
+        verify_proof(&theorem->proof, theorem->params, theorem->lhs, theorem->rhs, rules);
+    TRACE_END();
+    return verified;
+}
+
+void register_example(Example *example) {
+    if (example->lhs_marks.count) {
+        output("WARN: LHS of an example contains mark: ");
+        print_marked_expr(example->lhs, &example->lhs_marks);
+        example->lhs_marks = (Marks){0};
+    }
+    if (example->rhs_marks.count) {
+        output("WARN: RHS of an example contains mark: ");
+        print_marked_expr(example->rhs, &example->rhs_marks);
+        example->rhs_marks = (Marks){0};
+    }
+}
+
+bool verify_example(Example *example, Rules *rules) {
+    TRACE_BEGIN("example", nullptr);
+    bool verified = verify_proof(&example->proof, nullptr, example->lhs, example->rhs, rules);
+    TRACE_END();
+    return verified;
+}
+
+/* Verifies a registered toplevel's proof. `rules` must only show the rules declared before it. */
+bool verify_toplevel(TopLevel *toplevel, Rules *rules) {
+    switch (toplevel->tag) {
+    case TOPLEVEL_DEFINE:
+    case TOPLEVEL_IMPORT:
+        return true;
+    case TOPLEVEL_THEOREM:
+        return verify_theorem(&toplevel->theorem, rules);
+    case TOPLEVEL_EXAMPLE:
+        return verify_example(&toplevel->example, rules);
+    }
+    return false;
+}
+
+void free_thread_state(void) {
+    stats_collect();
+    trace_flush();
+    free_simp_state();
+    free_dtree_state();
+    free_search_state();
+    stack_free(&candidate_values);
+    stack_free(&unit_marks);
+    stack_free(&rebuild_frames);
+    stack_free(&rebuild_results);
+    stack_free(&match_frames);
+    stack_free(&match_cursors);
+}
@@ -0,0 +1,139 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "ast.h"
+#include "dtree.h"
+#include "stack.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Parameters a rule may have, so that bindings fit in a fixed-size array on the stack. */
+#define MAX_RULE_PARAMS 1024
+/* the slot of a pattern variable that isn't a parameter */
+#define NO_SLOT UINT32_MAX
+
+/* A rule side compiled by `add_rule`: for every variable of the pattern in reading order, the
+ * index of the parameter it is, or NO_SLOT. Matching visits the variables in the same order, so it
+ * binds and looks up parameters by index. */
+typedef struct {
+    uint32_t *slots;
+    size_t count;
+} ParamSlots;
+
+typedef struct _MatchOp MatchOp;
+
+/* A pattern compiled to C ahead of time, see native.h. `code` is the pattern's program, which it
+ * reads the constants from. */
+typedef bool (*NativeMatcher)(const MatchOp *code, Expr *expr, Expr **bindings);
+
+/* An instruction of a compiled pattern. The instructions of a pattern are its nodes in reading
+ * order, and each one matches the next expression of the sexp the matcher is in:
+ * - MATCH_DESCEND checks for a sexp of `arg` elements (a numeral n being (succ n-1)) and enters it,
+ *   MATCH_ASCEND leaves it again.
+ * - MATCH_CONST checks for `expr`, a whole subpattern without parameters, by identity.
+ * - MATCH_BIND binds slot `arg` at the first occurrence of a parameter, or compares it with what the
+ *   other side of the rule bound it to. MATCH_COMPARE compares it at the later occurrences.
+ * - MATCH_DONE ends the program.
+ * A program may start with MATCH_NATIVE, which runs `native` on the rest of the program instead. */
+struct _MatchOp {
+    enum {
+        MATCH_DESCEND,
+        MATCH_ASCEND,
+        MATCH_CONST,
+        MATCH_BIND,
+        MATCH_COMPARE,
+        MATCH_DONE,
+        MATCH_NATIVE,
+    } op;
+    uint32_t arg;
+    union {
+        Expr *expr;
+        NativeMatcher native;
+    };
+};
+
+typedef struct {
+    Ident name;
+    IdentList *params;
+    Expr *lhs;
+    Expr *rhs;
+    size_t params_count;
+    ParamSlots lhs_slots;
+    ParamSlots rhs_slots;
+    MatchOp *lhs_code; /* the sides compiled for `match_program` */
+    MatchOp *rhs_code;
+    uint64_t key; /* identifies the rule in the cache, see `toplevel_key` in main.c */
+    bool definition; /* declared by a define, so `simp` rewrites with it */
+    atomic_size_t applications; /* only counted with --stats */
+} Rule;
+
+/* Rules in declaration order, indexed by name with an open-addressing hash table. Slots hold the
+ * position of the rule plus one, so 0 marks an empty slot.
+ * Rules are only ever appended, so a copy of this header is a view of the rules declared so far:
+ * lookups through it ignore everything registered after `count`. */
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t index_capacity;
+    size_t *index;
+    Rule *rules;
+    DTree *tree; /* both sides of every rule, see `find_candidates` */
+    size_t version; /* changes whenever `rules` moves, so a view is identified by this and `count` */
+} Rules;
+
+typedef struct {
+    Rule *rule;
+    bool reversed; /* the RHS matched, so the rule applies from right to left */
+} Candidate;
+
+/* Set by --suggest: failed steps list the rules that would apply instead. */
+extern bool suggest_enabled;
+
+Rules *allocate_rules(size_t len);
+void free_rules(Rules *rules);
+void reserve_rules(Rules *rules, size_t additional);
+void add_rule(Rules *rules, Ident name, IdentList *params, Expr *lhs, Expr *rhs, uint64_t key,
+              bool definition);
+Rule *find_rule(Ident name, Rules *rules);
+ParamSlots compile_pattern(Expr *pattern, IdentList *params);
+/* Compiles `pattern` for `match_program`, running `native` if it's given. */
+MatchOp *compile_match(Expr *pattern, IdentList *params, NativeMatcher native);
+/* Runs the compiled pattern `code` against `expr`, binding into `bindings` by slot. */
+bool match_program(MatchOp *code, Expr *expr, Expr **bindings);
+/* Pushes a Candidate for every side of a rule in the view that may match `expr`, in declaration
+ * order. They're looked up in the rules' discrimination tree, in time independent of the number of
+ * rules, and still have to be checked with the matcher, e.g. by `apply_rule`. */
+void find_candidates(Rules *rules, Expr *expr, Stack *candidates);
+/* Rewrites `expr` at its root with one side of `rule`, returning the other side with the parameters
+ * bound by matching. nullptr if it doesn't match or the other side has a parameter left unbound. */
+Expr *apply_rule(Rule *rule, bool reversed, Expr *expr);
+
+typedef Expr *(*RebuildVisitor)(Expr *expr, void *ctx);
+
+Expr *rebuild_expr(Expr *expr, RebuildVisitor visit, void *ctx);
+/* `pattern` with its parameters replaced by their bindings, nullptr if one of them isn't bound.
+ * Bindings are indexed by the slots of the pattern, nullptr while unbound. Without slots the
+ * pattern has no parameters. */
+Expr *instantiate(Expr *pattern, ParamSlots *slots, Expr **bindings);
+/* The subexpression at the first of `marks`, warning about and dropping the others. */
+Expr *locate_mark(Expr *expr, Marks *marks);
+/* Interned expressions are equal only if they're the same node, so this is constant time. */
+bool expr_equals(Expr *a, Expr *b);
+bool expr_matches_pattern(Expr *expr, Expr *pattern, ParamSlots *slots, Expr **bindings);
+Expr *clone_expr_and_replace(Expr *orig, Expr *replacement, Ident param);
+bool verify_rule_left(Expr *expr, MatchOp *code, Expr **bindings);
+bool verify_rule_right(Expr *expr, MarkPath *mark, Expr *replace, Expr *target, MatchOp *code,
+                       Expr **bindings);
+bool verify_proof(Proof *proof, IdentList *params, Expr *lhs, Expr *rhs, Rules *rules);
+
+bool verify_define(Define *define, Rules *rules, uint64_t key);
+bool register_theorem(Theorem *theorem, Rules *rules, uint64_t key);
+void register_example(Example *example);
+bool verify_toplevel(TopLevel *toplevel, Rules *rules);
+/* Releases the calling thread's scratch memory and hands over its stats and trace events. Every
+ * thread that verifies has to call it. */
+void free_thread_state(void);
+
+#endif // !VERIFY_H